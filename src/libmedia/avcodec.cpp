@@ -1,5 +1,7 @@
+#include <algorithm>
 #include <iomanip>
 #include <sstream>
+#include <thread>
 #include "avcodec.h"
 
 bool FFAVCodec::initialize(const AVCodec *codec) {
@@ -29,39 +31,30 @@ std::shared_ptr<AVFrame> FFAVCodec::transformFrame(std::shared_ptr<AVFrame> fram
         if (frame->time_base.num == 0 || frame->time_base.den == 0)
             frame->time_base = context_->pkt_timebase;
     } else if (av_codec_is_encoder(codec_.get())) {
-        auto newframe = std::shared_ptr<AVFrame>(
-            av_frame_clone(frame.get()),
-            [&](AVFrame *p) {
-                av_frame_unref(p);
-                av_frame_free(&p);
-            }
-        );
+        frame = UniqueAVFrame(std::move(frame));
+        if (!frame)
+            return nullptr;
+
         if (av_cmp_q(frame->time_base, context_->time_base) != 0) {
-            newframe->time_base = context_->time_base;
-            newframe->pts = av_rescale_q_rnd(frame->pts, frame->time_base, context_->time_base,
+            frame->pts = av_rescale_q_rnd(frame->pts, frame->time_base, context_->time_base,
                 static_cast<AVRounding>(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
-            newframe->pkt_dts = av_rescale_q_rnd(frame->pkt_dts, frame->time_base, context_->time_base,
+            frame->pkt_dts = av_rescale_q_rnd(frame->pkt_dts, frame->time_base, context_->time_base,
                 static_cast<AVRounding>(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
-            newframe->duration = av_rescale_q(frame->duration, frame->time_base, context_->time_base);
+            frame->duration = av_rescale_q(frame->duration, frame->time_base, context_->time_base);
+            frame->time_base = context_->time_base;
         }
-        frame = newframe;
     }
 
     if (debug_.load()) {
-        std::cout << "[";
-        if (av_codec_is_decoder(codec_.get()))
-            std::cout << "D";
-        else if (av_codec_is_encoder(codec_.get()))
-            std::cout << "E";
-        else
-            std::cout << "-";
-        std::cout << ":" << avcodec_get_name(codec_->id)
-            << ":" << frame_count_.load()
-            << "]" << DumpAVFrame(frame.get())
-            << std::endl;
+        const char *mode = av_codec_is_decoder(codec_.get()) ? "D"
+            : av_codec_is_encoder(codec_.get()) ? "E" : "-";
+        AVLogDebug("[", mode,
+            ":", avcodec_get_name(codec_->id),
+            ":", frame_count_.load(),
+            "]", DumpAVFrame(frame.get()));
     }
-    if (swscale_)
-        frame = swscale_->Scale(frame, 0, context_->height, 32);
+    if (!deferred_scale_.load())
+        frame = ScaleFrame(frame);
     return frame;
 }
 
@@ -98,13 +91,16 @@ void FFAVCodec::SetDebug(bool debug) {
     debug_.store(debug);
 }
 
-bool FFAVCodec::SetSWScale(int dst_width, int dst_height, AVPixelFormat dst_pix_fmt, int flags) {
+bool FFAVCodec::SetSWScale(int dst_width, int dst_height, AVPixelFormat dst_pix_fmt, int flags, int threads) {
     std::lock_guard<std::recursive_mutex> lock(mutex_);
     auto params = GetParameters();
     auto swscale = std::make_shared<FFSWScale>(
         params->width, params->height, (AVPixelFormat)params->format,
         dst_width, dst_height, dst_pix_fmt, flags
     );
+    if (!swscale->SetThreads(threads))
+        return false;
+
     if (!swscale->Init())
         return false;
 
@@ -112,11 +108,21 @@ bool FFAVCodec::SetSWScale(int dst_width, int dst_height, AVPixelFormat dst_pix_
     return true;
 }
 
+void FFAVCodec::SetDeferredScale(bool deferred) {
+    deferred_scale_.store(deferred);
+}
+
+std::shared_ptr<AVFrame> FFAVCodec::ScaleFrame(std::shared_ptr<AVFrame> frame) {
+    if (!swscale_ || !frame)
+        return frame;
+    return swscale_->Scale(frame, 0, context_->height, 32);
+}
+
 bool FFAVCodec::Open() {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
     if (opened_.load())
         return true;
 
-    std::lock_guard<std::recursive_mutex> lock(mutex_);
     int ret = avcodec_open2(context_.get(), codec_.get(), nullptr);
     if (ret < 0) {
         return false;
@@ -127,11 +133,31 @@ bool FFAVCodec::Open() {
 }
 
 bool FFAVCodec::PacketEOF() const {
-    return packet_eof_.load() && packets_.empty();
+    return packet_eof_.load() && packets_.Empty();
 }
 
 bool FFAVCodec::FrameEOF() const {
-    return frame_eof_.load() && frames_.empty();
+    return frame_eof_.load() && frames_.Empty();
+}
+
+bool FFAVCodec::InputFull() const {
+    return av_codec_is_decoder(codec_.get()) ? packets_.Full() : frames_.Full();
+}
+
+FFAVQueueStats FFAVCodec::GetPacketQueueStats() const {
+    return packets_.GetStats();
+}
+
+FFAVQueueStats FFAVCodec::GetFrameQueueStats() const {
+    return frames_.GetStats();
+}
+
+FFAVStatsSnapshot FFAVCodec::GetStats() const {
+    auto snapshot = stats_.GetSnapshot();
+    auto queue = av_codec_is_decoder(codec_.get()) ? packets_.GetStats() : frames_.GetStats();
+    snapshot.queue_size = queue.size;
+    snapshot.queue_high_water = queue.high_water;
+    return snapshot;
 }
 
 std::shared_ptr<FFAVDecoder> FFAVDecoder::Create(AVCodecID id) {
@@ -141,6 +167,12 @@ std::shared_ptr<FFAVDecoder> FFAVDecoder::Create(AVCodecID id) {
     return instance;
 }
 
+std::atomic_int FFAVDecoder::reserved_threads_{0};
+
+FFAVDecoder::~FFAVDecoder() {
+    releaseThreads();
+}
+
 bool FFAVDecoder::initialize(AVCodecID id) {
     std::lock_guard<std::recursive_mutex> lock(mutex_);
     const AVCodec *codec = avcodec_find_decoder(id);
@@ -150,11 +182,22 @@ bool FFAVDecoder::initialize(AVCodecID id) {
     return FFAVCodec::initialize(codec);
 }
 
+// The flush is a flag rather than a null entry so it never waits for room,
+// it is sent once the packets queued before it are consumed.
 bool FFAVDecoder::sendPackets() {
-    while (!packets_.empty()) {
-        auto front = packets_.front();
-        auto pkt = front ? front.get() : nullptr;
+    while (true) {
+        bool flushed = flushed_packet_.load(std::memory_order_acquire);
+        auto front = packets_.Front();
+        if (!front && (!flushed || packet_eof_.load()))
+            return true;
+
+        auto pkt = front ? front->get() : nullptr;
+        if (pkt)
+            applyDiscard(pkt);
+
+        int64_t start = FFAVStats::Start();
         int ret = avcodec_send_packet(context_.get(), pkt);
+        stats_.Record(start, 0, ret >= 0 && pkt ? pkt->size : 0);
         if (ret < 0) {
             if (ret == AVERROR(EAGAIN)) {
             } else if (ret == AVERROR_EOF) {
@@ -163,22 +206,29 @@ bool FFAVDecoder::sendPackets() {
             return false;
         }
 
-        if (!pkt)
+        if (!pkt) {
             packet_eof_.store(true);
-
-        packets_.pop();
+        } else {
+            std::shared_ptr<AVPacket> packet;
+            packets_.Pop(packet);
+        }
         recvFrames();
     }
-    return true;
 }
 
 bool FFAVDecoder::recvFrames() {
-    while (true) {
+    // New frames wait until RecvFrame dropped the ones from before a Flush.
+    if (flush_generation_.load() != drained_generation_.load())
+        return false;
+
+    while (!frames_.Full()) {
         AVFrame *frame = av_frame_alloc();
         if (!frame)
             return false;
 
+        int64_t start = FFAVStats::Start();
         int ret = avcodec_receive_frame(context_.get(), frame);
+        stats_.Record(start, ret >= 0 ? 1 : 0, 0);
         if (ret < 0) {
             if (ret == AVERROR(EAGAIN)) {
                 lacked_packet_.store(true);
@@ -190,7 +240,12 @@ bool FFAVDecoder::recvFrames() {
         }
 
         lacked_packet_.store(false);
-        frames_.push(transformFrame(std::shared_ptr<AVFrame>(
+        if (discardFrame(frame)) {
+            av_frame_free(&frame);
+            continue;
+        }
+
+        frames_.Push(transformFrame(std::shared_ptr<AVFrame>(
             frame,
             [](AVFrame *p) {
                 av_frame_unref(p);
@@ -198,25 +253,69 @@ bool FFAVDecoder::recvFrames() {
             }
         )));
     }
-    return true;
+    return false;
 }
 
-bool FFAVDecoder::flushPacket() {
-    if (!flushed_packet_.load()) {
-        packets_.push(nullptr);
-        flushed_packet_.store(true);
-    }
+// Only non-reference frames are skipped or decoded without loop filter,
+// references before the target still feed the frames that are kept.
+void FFAVDecoder::applyDiscard(const AVPacket *packet) {
+    int64_t discard_pts = discard_pts_.load();
+    if (discard_pts == AV_NOPTS_VALUE)
+        return;
 
-    while (true) {
-        if (packet_eof_.load())
-            break;
+    bool before = packet->pts != AV_NOPTS_VALUE && packet->pts < discard_pts;
+    context_->skip_frame = before ? AVDISCARD_NONREF : skip_frame_;
+    context_->skip_loop_filter = before ? AVDISCARD_NONREF : skip_loop_filter_;
+    context_->skip_idct = before ? AVDISCARD_NONREF : skip_idct_;
+}
 
-        if (!sendPackets())
-            return false;
+bool FFAVDecoder::discardFrame(const AVFrame *frame) {
+    int64_t discard_pts = discard_pts_.load();
+    if (discard_pts == AV_NOPTS_VALUE)
+        return false;
+
+    int64_t pts = frame->pts != AV_NOPTS_VALUE ? frame->pts : frame->best_effort_timestamp;
+    if (pts != AV_NOPTS_VALUE) {
+        if (codec_->type == AVMEDIA_TYPE_AUDIO)
+            pts += frame->duration;
+        if (codec_->type == AVMEDIA_TYPE_AUDIO ? pts <= discard_pts : pts < discard_pts)
+            return true;
     }
+
+    discard_pts_.store(AV_NOPTS_VALUE);
+    context_->skip_frame = skip_frame_;
+    context_->skip_loop_filter = skip_loop_filter_;
+    context_->skip_idct = skip_idct_;
+    return false;
+}
+
+// Only the sending side pushes, so room found here is still there when the
+// packet is pushed.
+bool FFAVDecoder::reservePacket() {
+    if (!packets_.Full())
+        return true;
+
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    recvFrames();
+    sendPackets();
+    return !packets_.Full();
+}
+
+bool FFAVDecoder::flushPacket() {
+    flushed_packet_.store(true, std::memory_order_release);
+    std::unique_lock<std::recursive_mutex> lock(mutex_, std::try_to_lock);
+    if (lock.owns_lock())
+        sendPackets();
     return true;
 }
 
+void FFAVDecoder::drainFrames() {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    std::shared_ptr<AVFrame> frame;
+    while (frames_.Pop(frame)) {}
+    drained_generation_.store(flush_generation_.load());
+}
+
 bool FFAVDecoder::SetParameters(const AVCodecParameters& params) {
     std::lock_guard<std::recursive_mutex> lock(mutex_);
     int ret = avcodec_parameters_to_context(context_.get(), &params);
@@ -230,25 +329,135 @@ void FFAVDecoder::SetTimeBase(const AVRational& time_base) {
     context_->pkt_timebase = time_base;
 }
 
-bool FFAVDecoder::SendPacket(std::shared_ptr<AVPacket> packet) {
+bool FFAVDecoder::SetThreadOption(const FFAVThreadOption& option) {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    if (opened_.load())
+        return false;
+
+    int capabilities = codec_->capabilities;
+    int supported = 0;
+    if (capabilities & AV_CODEC_CAP_FRAME_THREADS)
+        supported |= FF_THREAD_FRAME;
+    if (capabilities & AV_CODEC_CAP_SLICE_THREADS)
+        supported |= FF_THREAD_SLICE;
+
+    if (option.thread_type != 0) {
+        if (!(option.thread_type & supported))
+            return false;
+        context_->thread_type = option.thread_type & supported;
+    } else if (supported) {
+        context_->thread_type = supported;
+    }
+
+    releaseThreads();
+    if (option.thread_count < 0)
+        return true;
+
+    if (option.thread_count > 0) {
+        context_->thread_count = supported ? option.thread_count : 1;
+        return true;
+    }
+
+    int count = autoThreadCount();
+    reserved_.store(count);
+    reserved_threads_ += count;
+    context_->thread_count = count;
+    return true;
+}
+
+int FFAVDecoder::GetThreadCount() const {
+    return context_->thread_count;
+}
+
+int FFAVDecoder::GetThreadType() const {
+    return context_->thread_type;
+}
+
+int FFAVDecoder::autoThreadCount() const {
+    int capabilities = codec_->capabilities;
+    if (!(capabilities & (AV_CODEC_CAP_FRAME_THREADS | AV_CODEC_CAP_SLICE_THREADS)))
+        return 1;
+
+    int64_t pixels = int64_t(context_->width) * context_->height;
+    int count = 1;
+    if (pixels > 3840 * 2160)
+        count = 16;
+    else if (pixels > 1920 * 1080)
+        count = 8;
+    else if (pixels > 1280 * 720)
+        count = 4;
+    else if (pixels > 640 * 480)
+        count = 2;
+
+    // Frame threading adds one frame of delay per thread, slice threading
+    // only pays off when the encoder produced enough slices.
+    if (!(context_->thread_type & FF_THREAD_FRAME))
+        count = std::min(count, 4);
+
+    int cores = std::max(1, int(std::thread::hardware_concurrency()));
+    int available = cores - reserved_threads_.load();
+    return std::max(1, std::min(count, available));
+}
+
+void FFAVDecoder::releaseThreads() {
+    reserved_threads_ -= reserved_.exchange(0);
+}
+
+void FFAVDecoder::SetDiscardUntil(int64_t pts) {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    if (discard_pts_.load() == AV_NOPTS_VALUE) {
+        skip_frame_ = context_->skip_frame;
+        skip_loop_filter_ = context_->skip_loop_filter;
+        skip_idct_ = context_->skip_idct;
+    }
+    discard_pts_.store(pts);
+}
+
+bool FFAVDecoder::Flush() {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    if (opened_.load())
+        avcodec_flush_buffers(context_.get());
+
+    std::shared_ptr<AVPacket> packet;
+    while (packets_.Pop(packet)) {}
+    flush_generation_++;
+
+    packet_eof_.store(false);
+    frame_eof_.store(false);
+    lacked_packet_.store(false);
+    flushed_packet_.store(false);
+    return true;
+}
+
+bool FFAVDecoder::SendPacket(std::shared_ptr<AVPacket>&& packet) {
     if (!packet)
         return flushPacket();
 
-    if (!sendPackets())
+    if (!reservePacket())
         return false;
+    packets_.Push(transformPacket(std::move(packet)));
 
-    packets_.push(transformPacket(packet));
-    return sendPackets();
+    // Decoding is left to RecvFrame when it already runs on another thread.
+    std::unique_lock<std::recursive_mutex> lock(mutex_, std::try_to_lock);
+    if (lock.owns_lock())
+        sendPackets();
+    return true;
 }
 
 std::shared_ptr<AVFrame> FFAVDecoder::RecvFrame() {
-    recvFrames();
-    if (frames_.empty())
-        return nullptr;
+    if (flush_generation_.load() != drained_generation_.load())
+        drainFrames();
 
-    auto frame = frames_.front();
-    frames_.pop();
-    return frame;
+    std::shared_ptr<AVFrame> frame;
+    if (frames_.Pop(frame))
+        return frame;
+
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    recvFrames();
+    sendPackets();
+    if (frames_.Pop(frame))
+        return frame;
+    return nullptr;
 }
 
 bool FFAVDecoder::LackedPacket() const {
@@ -270,6 +479,61 @@ bool FFAVEncoder::initialize(AVCodecID id) {
     return FFAVCodec::initialize(codec);
 }
 
+// Copies the configuration of a not yet used encoder, so independent
+// instances produce packets that can be joined into one stream.
+std::shared_ptr<FFAVEncoder> FFAVEncoder::Clone() const {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    auto instance = std::shared_ptr<FFAVEncoder>(new FFAVEncoder());
+    if (!instance->FFAVCodec::initialize(codec_.get()))
+        return nullptr;
+
+    const AVCodecContext *src = context_.get();
+    AVCodecContext *dst = instance->context_.get();
+    dst->bit_rate = src->bit_rate;
+    dst->rc_min_rate = src->rc_min_rate;
+    dst->rc_max_rate = src->rc_max_rate;
+    dst->rc_buffer_size = src->rc_buffer_size;
+    dst->global_quality = src->global_quality;
+    dst->qmin = src->qmin;
+    dst->qmax = src->qmax;
+    dst->flags = src->flags;
+    dst->flags2 = src->flags2;
+    dst->time_base = src->time_base;
+    dst->framerate = src->framerate;
+    dst->gop_size = src->gop_size;
+    dst->max_b_frames = src->max_b_frames;
+    dst->thread_count = src->thread_count;
+    dst->thread_type = src->thread_type;
+    dst->profile = src->profile;
+    dst->level = src->level;
+    dst->width = src->width;
+    dst->height = src->height;
+    dst->pix_fmt = src->pix_fmt;
+    dst->sample_aspect_ratio = src->sample_aspect_ratio;
+    dst->color_range = src->color_range;
+    dst->color_primaries = src->color_primaries;
+    dst->color_trc = src->color_trc;
+    dst->colorspace = src->colorspace;
+    dst->chroma_sample_location = src->chroma_sample_location;
+    dst->sample_fmt = src->sample_fmt;
+    dst->sample_rate = src->sample_rate;
+    int ret = av_channel_layout_copy(&dst->ch_layout, &src->ch_layout);
+    if (ret < 0)
+        return nullptr;
+
+    if (src->priv_data && dst->priv_data) {
+        ret = av_opt_copy(dst->priv_data, src->priv_data);
+        if (ret < 0) {
+            AVLogError("av_opt_copy(", codec_->name, "): ", AVErrorStr(ret));
+            return nullptr;
+        }
+    }
+
+    instance->expected_delay_.store(expected_delay_.load());
+    instance->debug_.store(debug_.load());
+    return instance;
+}
+
 template <typename T, typename Compare>
 bool FFAVEncoder::checkConfig(AVCodecConfig config, const T& value, Compare compare) {
     int num_configs = 0;
@@ -289,48 +553,57 @@ bool FFAVEncoder::checkConfig(AVCodecConfig config, const T& value, Compare comp
 }
 
 bool FFAVEncoder::sendFrames() {
-    while (!frames_.empty()) {
-        auto front = frames_.front();
-        auto frm = front ? front.get() : nullptr;
+    while (true) {
+        bool flushed = flushed_frame_.load(std::memory_order_acquire);
+        auto front = frames_.Front();
+        if (!front && (!flushed || frame_eof_.load()))
+            return true;
+
+        auto frm = front ? front->get() : nullptr;
+        int64_t start = FFAVStats::Start();
         int ret = avcodec_send_frame(context_.get(), frm);
+        stats_.Record(start, 0, 0);
         if (ret < 0) {
             if (ret == AVERROR(EAGAIN)) {
             } else if (ret == AVERROR_EOF) {
                 frame_eof_.store(true);
             } else
-                std::cerr << "avcodec_send_frame: " << AVErrorStr(ret) << std::endl;
+                AVLogError("avcodec_send_frame: ", AVErrorStr(ret));
             return false;
         }
 
-        if (!frm)
+        if (!frm) {
             frame_eof_.store(true);
-
-        frames_.pop();
+        } else {
+            std::shared_ptr<AVFrame> frame;
+            frames_.Pop(frame);
+        }
         recvPackets();
     }
-    return true;
 }
 
 bool FFAVEncoder::recvPackets() {
-    while (true) {
+    while (!packets_.Full()) {
         AVPacket *packet = av_packet_alloc();
         if (!packet)
             return false;
 
+        int64_t start = FFAVStats::Start();
         int ret = avcodec_receive_packet(context_.get(), packet);
+        stats_.Record(start, ret >= 0 ? 1 : 0, ret >= 0 ? packet->size : 0);
         if (ret < 0) {
             if (ret == AVERROR(EAGAIN))
                 lacked_frame_.store(true);
             else if (ret == AVERROR_EOF)
                 packet_eof_.store(true);
             else
-                std::cerr << "avcodec_receive_packet: " << AVErrorStr(ret) << std::endl;
+                AVLogError("avcodec_receive_packet: ", AVErrorStr(ret));
             av_packet_free(&packet);
             return false;
         }
 
         lacked_frame_.store(false);
-        packets_.push(transformPacket(std::shared_ptr<AVPacket>(
+        packets_.Push(transformPacket(std::shared_ptr<AVPacket>(
             packet,
             [](AVPacket *p) {
                 av_packet_unref(p);
@@ -338,22 +611,24 @@ bool FFAVEncoder::recvPackets() {
             }
         )));
     }
-    return true;
+    return false;
 }
 
-bool FFAVEncoder::flushFrame() {
-    if (!flushed_frame_.load()) {
-        frames_.push(nullptr);
-        flushed_frame_.store(true);
-    }
+bool FFAVEncoder::reserveFrame() {
+    if (!frames_.Full())
+        return true;
 
-    while (true) {
-        if (frame_eof_.load())
-            break;
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    recvPackets();
+    sendFrames();
+    return !frames_.Full();
+}
 
-        if (!sendFrames())
-            return false;
-    }
+bool FFAVEncoder::flushFrame() {
+    flushed_frame_.store(true, std::memory_order_release);
+    std::unique_lock<std::recursive_mutex> lock(mutex_, std::try_to_lock);
+    if (lock.owns_lock())
+        sendFrames();
     return true;
 }
 
@@ -431,25 +706,125 @@ bool FFAVEncoder::SetOptions(const std::unordered_map<std::string, std::string>&
     return true;
 }
 
-bool FFAVEncoder::SendFrame(std::shared_ptr<AVFrame> frame) {
+bool FFAVEncoder::SetProfile(FFAVEncodeProfile profile) {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    if (opened_.load())
+        return false;
+
+    int supported = 0;
+    if (codec_->capabilities & AV_CODEC_CAP_FRAME_THREADS)
+        supported |= FF_THREAD_FRAME;
+    if (codec_->capabilities & AV_CODEC_CAP_SLICE_THREADS)
+        supported |= FF_THREAD_SLICE;
+
+    // libx264/libx265 run their own thread pools and only read these hints.
+    std::string name = codec_->name;
+    if (name == "libx264" || name == "libx265")
+        supported = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
+    if (codec_->type != AVMEDIA_TYPE_VIDEO) {
+        context_->thread_count = supported ? 0 : 1;
+        context_->thread_type = supported;
+        expected_delay_.store(0);
+        return true;
+    }
+
+    int cores = std::max(1, int(std::thread::hardware_concurrency()));
+    int threads = 0;
+    int bframes = 0;
+    int lookahead = 0;
+    switch (profile) {
+    case FFAVEncodeProfile::Throughput:
+        threads = 0;
+        bframes = 3;
+        lookahead = 60;
+        context_->thread_type = supported;
+        break;
+    case FFAVEncodeProfile::Balanced:
+        threads = std::max(1, cores / 2);
+        bframes = 2;
+        lookahead = 20;
+        context_->thread_type = supported;
+        break;
+    case FFAVEncodeProfile::LowLatency:
+        threads = std::min(cores, 4);
+        bframes = 0;
+        lookahead = 0;
+        context_->thread_type = supported & FF_THREAD_SLICE;
+        break;
+    }
+
+    context_->thread_count = supported ? threads : 1;
+    context_->max_b_frames = bframes;
+
+    if (name == "libx264") {
+        if (!setPrivOption("rc-lookahead", std::to_string(lookahead)))
+            return false;
+        if (profile == FFAVEncodeProfile::LowLatency && !setPrivOption("tune", "zerolatency"))
+            return false;
+    } else if (name == "libx265") {
+        int frame_threads = profile == FFAVEncodeProfile::LowLatency ? 1 : 0;
+        std::string params = "rc-lookahead=" + std::to_string(lookahead)
+            + ":bframes=" + std::to_string(bframes)
+            + ":frame-threads=" + std::to_string(frame_threads);
+        if (!setPrivOption("x265-params", params))
+            return false;
+        if (profile == FFAVEncodeProfile::LowLatency && !setPrivOption("tune", "zerolatency"))
+            return false;
+    }
+
+    // Auto thread_count lets the codec size its pool from the cores, so
+    // the delay estimate budgets one frame thread per core.
+    int frame_threads = threads > 0 ? threads : cores;
+    int frame_delay = (context_->thread_type & FF_THREAD_FRAME) ? frame_threads - 1 : 0;
+    expected_delay_.store(lookahead + bframes + frame_delay);
+    return true;
+}
+
+int FFAVEncoder::GetDelay() const {
+    if (opened_.load() && context_->delay > 0)
+        return context_->delay;
+    return expected_delay_.load();
+}
+
+bool FFAVEncoder::setPrivOption(const std::string& name, const std::string& val) {
+    int ret = av_opt_set(context_->priv_data, name.c_str(), val.c_str(), 0);
+    if (ret < 0) {
+        AVLogError("av_opt_set(", name, "=", val, "): ", AVErrorStr(ret));
+        return false;
+    }
+    return true;
+}
+
+bool FFAVEncoder::SendFrame(std::shared_ptr<AVFrame>&& frame) {
     if (!frame)
         return flushFrame();
 
-    if (!sendFrames())
+    if (!reserveFrame())
         return false;
 
-    frames_.push(transformFrame(frame));
-    return sendFrames();
+    auto newframe = transformFrame(std::move(frame));
+    if (!newframe)
+        return false;
+    frames_.Push(std::move(newframe));
+
+    std::unique_lock<std::recursive_mutex> lock(mutex_, std::try_to_lock);
+    if (lock.owns_lock())
+        sendFrames();
+    return true;
 }
 
 std::shared_ptr<AVPacket> FFAVEncoder::RecvPacket() {
-    recvPackets();
-    if (packets_.empty())
-        return nullptr;
+    std::shared_ptr<AVPacket> packet;
+    if (packets_.Pop(packet))
+        return packet;
 
-    auto packet = packets_.front();
-    packets_.pop();
-    return packet;
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    recvPackets();
+    sendFrames();
+    if (packets_.Pop(packet))
+        return packet;
+    return nullptr;
 }
 
 bool FFAVEncoder::LackedFrame() const {
@@ -6,8 +6,9 @@
 #include <iostream>
 #include <memory>
 #include <mutex>
-#include <queue>
 #include <string>
+#include "avqueue.h"
+#include "avstats.h"
 #include "avutil.h"
 #include "swscale.h"
 extern "C" {
@@ -16,6 +17,21 @@ extern "C" {
 #include <libavutil/opt.h>
 }
 
+// thread_count: -1 keeps the libavcodec default, 0 picks one from the
+// resolution, the codec capabilities and the process-wide core budget.
+// thread_type: FF_THREAD_FRAME and/or FF_THREAD_SLICE, 0 for both when
+// the codec supports them.
+struct FFAVThreadOption {
+    int thread_count{-1};
+    int thread_type{0};
+};
+
+enum class FFAVEncodeProfile {
+    Throughput,
+    Balanced,
+    LowLatency,
+};
+
 class FFAVCodec {
 public:
     std::shared_ptr<const AVCodec> GetCodec() const;
@@ -24,10 +40,18 @@ public:
     std::shared_ptr<FFSWScale> GetSWScale() const;
     int64_t GetFrameCount() const;
     void SetDebug(bool debug);
-    bool SetSWScale(int dst_width, int dst_height, AVPixelFormat dst_pix_fmt, int flags);
+    bool SetSWScale(int dst_width, int dst_height, AVPixelFormat dst_pix_fmt, int flags, int threads = 1);
+    void SetDeferredScale(bool deferred);
+    std::shared_ptr<AVFrame> ScaleFrame(std::shared_ptr<AVFrame> frame);
     bool Open();
     bool PacketEOF() const;
     bool FrameEOF() const;
+    // The input ring is full, the codec takes more once its output is
+    // picked up.
+    bool InputFull() const;
+    FFAVQueueStats GetPacketQueueStats() const;
+    FFAVQueueStats GetFrameQueueStats() const;
+    FFAVStatsSnapshot GetStats() const;
 
 protected:
     FFAVCodec() = default;
@@ -40,23 +64,31 @@ protected:
     std::atomic_bool debug_{false};
     std::atomic_bool packet_eof_{false};
     std::atomic_bool frame_eof_{false};
+    std::atomic_bool deferred_scale_{false};
+    std::atomic_bool opened_{false};
     std::atomic_int64_t frame_count_{0};
     std::shared_ptr<const AVCodec> codec_;
     std::shared_ptr<AVCodecContext> context_;
     std::shared_ptr<FFSWScale> swscale_;
-    std::queue<std::shared_ptr<AVPacket>> packets_;
-    std::queue<std::shared_ptr<AVFrame>> frames_;
-
-private:
-    std::atomic_bool opened_;
+    FFAVStats stats_;
+    FFAVRingQueue<std::shared_ptr<AVPacket>> packets_{64};
+    FFAVRingQueue<std::shared_ptr<AVFrame>> frames_{16};
 };
 
 class FFAVDecoder final : public FFAVCodec {
 public:
     static std::shared_ptr<FFAVDecoder> Create(AVCodecID id);
+    ~FFAVDecoder();
     bool SetParameters(const AVCodecParameters& params);
     void SetTimeBase(const AVRational& time_base);
-    bool SendPacket(std::shared_ptr<AVPacket> packet);
+    bool SetThreadOption(const FFAVThreadOption& option);
+    int GetThreadCount() const;
+    int GetThreadType() const;
+    void SetDiscardUntil(int64_t pts);
+    bool Flush();
+    // Returns false and leaves the packet with the caller while InputFull(),
+    // RecvFrame() makes room. A null packet flushes and is never refused.
+    bool SendPacket(std::shared_ptr<AVPacket>&& packet);
     std::shared_ptr<AVFrame> RecvFrame();
     bool LackedPacket() const;
 
@@ -65,23 +97,44 @@ private:
     bool initialize(AVCodecID id);
     bool sendPackets();
     bool recvFrames();
+    bool reservePacket();
+    void drainFrames();
     bool flushPacket();
+    int autoThreadCount() const;
+    void releaseThreads();
+    void applyDiscard(const AVPacket *packet);
+    bool discardFrame(const AVFrame *frame);
 
 private:
+    static std::atomic_int reserved_threads_;
+    std::atomic_int64_t discard_pts_{AV_NOPTS_VALUE};
+    AVDiscard skip_frame_{AVDISCARD_DEFAULT};
+    AVDiscard skip_loop_filter_{AVDISCARD_DEFAULT};
+    AVDiscard skip_idct_{AVDISCARD_DEFAULT};
+    std::atomic_int reserved_{0};
     std::atomic_bool lacked_packet_{false};
     std::atomic_bool flushed_packet_{false};
+    // Flush() only bumps flush_generation_, the RecvFrame() side empties
+    // frames_ since it is the ring's only consumer.
+    std::atomic_uint64_t flush_generation_{0};
+    std::atomic_uint64_t drained_generation_{0};
 };
 
 class FFAVEncoder final : public FFAVCodec {
 public:
     static std::shared_ptr<FFAVEncoder> Create(AVCodecID id);
+    std::shared_ptr<FFAVEncoder> Clone() const;
     bool SetParameters(const AVCodecParameters& params);
     void SetGopSize(int gop_size);
     void SetMaxBFrames(int max_b_frames);
     void SetFlags(int flags);
     bool SetOption(const std::string& name, const std::string& val, int search_flags);
     bool SetOptions(const std::unordered_map<std::string, std::string>& options);
-    bool SendFrame(std::shared_ptr<AVFrame> frame);
+    bool SetProfile(FFAVEncodeProfile profile);
+    int GetDelay() const;
+    // Returns false and leaves the frame with the caller while InputFull(),
+    // RecvPacket() makes room. A null frame flushes and is never refused.
+    bool SendFrame(std::shared_ptr<AVFrame>&& frame);
     std::shared_ptr<AVPacket> RecvPacket();
     bool LackedFrame() const;
 
@@ -92,9 +145,12 @@ private:
     bool checkConfig(AVCodecConfig config, const T& value, Compare compare = Compare());
     bool sendFrames();
     bool recvPackets();
+    bool reserveFrame();
     bool flushFrame();
+    bool setPrivOption(const std::string& name, const std::string& val);
 
 private:
+    std::atomic_int expected_delay_{0};
     std::atomic_bool lacked_frame_{false};
     std::atomic_bool flushed_frame_{false};
 };
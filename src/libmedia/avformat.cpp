@@ -1,4 +1,9 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iomanip>
+#include <sstream>
 #include "avformat.h"
 
 std::shared_ptr<FFAVStream> FFAVStream::Create(
@@ -22,6 +27,12 @@ bool FFAVStream::flushStream() {
     return true;
 }
 
+bool FFAVStream::requestFlush() {
+    if (deferred_flush_.load())
+        return true;
+    return flushStream();
+}
+
 int64_t FFAVStream::getPacketDts() const {
     return packet_dts_.load();
 }
@@ -34,15 +45,17 @@ void FFAVStream::setFmtStartTime(int64_t start_time) {
     if (fmt_start_time_.load() == AV_NOPTS_VALUE) {
         auto fmt_starttime = av_rescale_q(start_time, AV_TIME_BASE_Q, stream_->time_base);
         fmt_start_time_.store(fmt_starttime);
-        std::cout << "[FmtStartTime]" << context_->url
-            << " index:" << stream_->index
-            << " time_base:" << stream_->time_base.den
-            << " start_time:" << fmt_starttime
-            << std::endl;
+        AVLogInfo("[FmtStartTime]", context_->url,
+            " index:", stream_->index,
+            " time_base:", stream_->time_base.den,
+            " start_time:", fmt_starttime);
     }
 }
 
 void FFAVStream::resetTimeBase(const AVRational& time_base) {
+    if (start_time_.load() == AV_NOPTS_VALUE)
+        return;
+
     start_time_.store(
         av_rescale_q(start_time_.load(), time_base, stream_->time_base));
     first_dts_.store(
@@ -51,14 +64,13 @@ void FFAVStream::resetTimeBase(const AVRational& time_base) {
         av_rescale_q(pkt_duration_.load(), time_base, stream_->time_base));
     limit_duration_.store(
         av_rescale_q(limit_duration_.load(), time_base, stream_->time_base));
-    std::cout << "[StartTimeReset]" << context_->url
-        << " index:" << stream_->index
-        << " time_base:" << stream_->time_base.den
-        << " start_time:" << start_time_.load()
-        << " first_dts:" << first_dts_.load()
-        << " pkt_duration:" << pkt_duration_.load()
-        << " limit_duration:" << limit_duration_.load()
-        << std::endl;
+    AVLogInfo("[StartTimeReset]", context_->url,
+        " index:", stream_->index,
+        " time_base:", stream_->time_base.den,
+        " start_time:", start_time_.load(),
+        " first_dts:", first_dts_.load(),
+        " pkt_duration:", pkt_duration_.load(),
+        " limit_duration:", limit_duration_.load());
 }
 
 std::shared_ptr<AVPacket> FFAVStream::setStartTime(std::shared_ptr<AVPacket> packet) {
@@ -68,19 +80,24 @@ std::shared_ptr<AVPacket> FFAVStream::setStartTime(std::shared_ptr<AVPacket> pac
     if (start_time_.load() != AV_NOPTS_VALUE)
         return packet;
 
-    start_time_.store(packet->pts);
+    // Accurate seek counts the duration from the target, not the keyframe.
+    int64_t start_time = packet->pts;
+    int64_t seek_pts = seek_pts_.load();
+    if (seek_pts != AV_NOPTS_VALUE && start_time != AV_NOPTS_VALUE && start_time < seek_pts)
+        start_time = seek_pts;
+
+    start_time_.store(start_time);
     first_dts_.store(packet->dts);
     pkt_duration_.store(packet->duration);
     limit_duration_.store(
         av_rescale_q(limit_duration_.load(), AV_TIME_BASE_Q, stream_->time_base));
-    std::cout << "[StartTimeByPacket]" << context_->url
-        << " index:" << stream_->index
-        << " time_base:" << stream_->time_base.den
-        << " start_time:" << start_time_.load()
-        << " first_dts:" << first_dts_.load()
-        << " pkt_duration:" << pkt_duration_.load()
-        << " limit_duration:" << limit_duration_.load()
-        << std::endl;
+    AVLogInfo("[StartTimeByPacket]", context_->url,
+        " index:", stream_->index,
+        " time_base:", stream_->time_base.den,
+        " start_time:", start_time_.load(),
+        " first_dts:", first_dts_.load(),
+        " pkt_duration:", pkt_duration_.load(),
+        " limit_duration:", limit_duration_.load());
     return packet;
 }
 
@@ -96,14 +113,13 @@ std::shared_ptr<AVFrame> FFAVStream::setStartTime(std::shared_ptr<AVFrame> frame
     pkt_duration_.store(frame->duration);
     limit_duration_.store(
         av_rescale_q(limit_duration_.load(), AV_TIME_BASE_Q, stream_->time_base));
-    std::cout << "[StartTimeByFrame]" << context_->url
-        << " index:" << stream_->index
-        << " time_base:" << stream_->time_base.den
-        << " start_time:" << start_time_.load()
-        << " first_dts:" << first_dts_.load()
-        << " pkt_duration:" << pkt_duration_.load()
-        << " limit_duration:" << limit_duration_.load()
-        << std::endl;
+    AVLogInfo("[StartTimeByFrame]", context_->url,
+        " index:", stream_->index,
+        " time_base:", stream_->time_base.den,
+        " start_time:", start_time_.load(),
+        " first_dts:", first_dts_.load(),
+        " pkt_duration:", pkt_duration_.load(),
+        " limit_duration:", limit_duration_.load());
     return frame;
 }
 
@@ -117,7 +133,7 @@ std::shared_ptr<AVPacket> FFAVStream::setLimitStatus(std::shared_ptr<AVPacket> p
     if (limit_duration_.load() > 0) {
         int64_t current_duration = packet->pts - start_time_.load() - pkt_duration_.load();
         if (current_duration >= limit_duration_.load()) {
-            if (!flushStream())
+            if (!requestFlush())
                 return packet;
             reached_limit_.store(true);
         }
@@ -135,28 +151,25 @@ std::shared_ptr<AVPacket> FFAVStream::transformPacket(std::shared_ptr<AVPacket>
     }
 
     if (context_->oformat) {
-        auto newpacket = std::shared_ptr<AVPacket>(
-            av_packet_clone(packet.get()),
-            [&](AVPacket *p) {
-                av_packet_unref(p);
-                av_packet_free(&p);
-            }
-        );
-        newpacket->stream_index = stream_->index;
-        newpacket->pos = -1;
+        // Rewritten in place when the caller handed over its only reference.
+        packet = UniqueAVPacket(std::move(packet));
+        if (!packet)
+            return nullptr;
+
+        packet->stream_index = stream_->index;
+        packet->pos = -1;
         if (av_cmp_q(packet->time_base, stream_->time_base) != 0) {
-            newpacket->time_base = stream_->time_base;
-            newpacket->pts = av_rescale_q_rnd(packet->pts, packet->time_base, stream_->time_base,
+            packet->pts = av_rescale_q_rnd(packet->pts, packet->time_base, stream_->time_base,
                 static_cast<AVRounding>(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
-            newpacket->dts = av_rescale_q_rnd(packet->dts, packet->time_base, stream_->time_base,
+            packet->dts = av_rescale_q_rnd(packet->dts, packet->time_base, stream_->time_base,
                 static_cast<AVRounding>(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
-            newpacket->duration = av_rescale_q(packet->duration, packet->time_base, stream_->time_base);
+            packet->duration = av_rescale_q(packet->duration, packet->time_base, stream_->time_base);
+            packet->time_base = stream_->time_base;
         }
-        packet = newpacket;
     }
 
     packet_dts_.store(packet->dts);
-    return setStartTime(packet);
+    return setStartTime(std::move(packet));
 }
 
 std::shared_ptr<AVFrame> FFAVStream::transformFrame(std::shared_ptr<AVFrame> frame) {
@@ -168,44 +181,34 @@ std::shared_ptr<AVFrame> FFAVStream::transformFrame(std::shared_ptr<AVFrame> fra
     }
 
     if (context_->oformat) {
-        auto newframe = std::shared_ptr<AVFrame>(
-            av_frame_clone(frame.get()),
-            [&](AVFrame *p) {
-                av_frame_unref(p);
-                av_frame_free(&p);
-            }
-        );
+        frame = UniqueAVFrame(std::move(frame));
+        if (!frame)
+            return nullptr;
+
         if (av_cmp_q(frame->time_base, stream_->time_base) != 0) {
-            newframe->time_base = stream_->time_base;
-            newframe->pts = av_rescale_q_rnd(frame->pts, frame->time_base, stream_->time_base,
+            frame->pts = av_rescale_q_rnd(frame->pts, frame->time_base, stream_->time_base,
                 static_cast<AVRounding>(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
-            newframe->pkt_dts = av_rescale_q_rnd(frame->pkt_dts, frame->time_base, stream_->time_base,
+            frame->pkt_dts = av_rescale_q_rnd(frame->pkt_dts, frame->time_base, stream_->time_base,
                 static_cast<AVRounding>(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
-            newframe->duration = av_rescale_q(frame->duration, frame->time_base, stream_->time_base);
+            frame->duration = av_rescale_q(frame->duration, frame->time_base, stream_->time_base);
+            frame->time_base = stream_->time_base;
         }
-        frame = newframe;
     }
 
     frame_pts_.store(frame->pts);
-    return setStartTime(frame);
+    return setStartTime(std::move(frame));
 }
 
 std::shared_ptr<AVPacket> FFAVStream::formatPacket(std::shared_ptr<AVPacket> packet) {
     packet_count_++;
-    auto pkt = setLimitStatus(transformPacket(packet));
+    auto pkt = setLimitStatus(transformPacket(std::move(packet)));
 
     if (debug_.load()) {
-        std::cout << "[";
-        if (context_->iformat)
-            std::cout << "R";
-        else if (context_->oformat)
-            std::cout << "W";
-        else
-            std::cout << "-";
-        std::cout << ":" << pkt->stream_index
-            << ":" << packet_count_.load()
-            << "]" << DumpAVPacket(pkt.get())
-            << std::endl;
+        const char *mode = context_->iformat ? "R" : context_->oformat ? "W" : "-";
+        AVLogDebug("[", mode,
+            ":", pkt->stream_index,
+            ":", packet_count_.load(),
+            "]", DumpAVPacket(pkt.get()));
     }
 
     if (context_->oformat) {
@@ -258,6 +261,10 @@ bool FFAVStream::ReachLimit() const {
     return reached_limit_.load();
 }
 
+FFAVStatsSnapshot FFAVStream::GetStats() const {
+    return stats_.GetSnapshot();
+}
+
 bool FFAVStream::SetMetadata(const std::unordered_map<std::string, std::string>& metadata) {
     if (!context_->oformat)
         return false;
@@ -300,24 +307,30 @@ void FFAVStream::SetDebug(bool debug) {
     debug_.store(debug);
 }
 
+void FFAVStream::SetDeferredFlush(bool deferred) {
+    deferred_flush_.store(deferred);
+}
+
 std::shared_ptr<FFAVDecodeStream> FFAVDecodeStream::Create(
     std::shared_ptr<AVFormatContext> context,
-    std::shared_ptr<AVStream> stream) {
+    std::shared_ptr<AVStream> stream,
+    const FFAVThreadOption& option) {
     auto instance = std::shared_ptr<FFAVDecodeStream>(new FFAVDecodeStream());
-    if (!instance->initialize(context, stream))
+    if (!instance->initialize(context, stream, option))
         return nullptr;
     return instance;
 }
 
 bool FFAVDecodeStream::initialize(
     std::shared_ptr<AVFormatContext> context,
-    std::shared_ptr<AVStream> stream) {
-    if (!initDecoder(stream))
+    std::shared_ptr<AVStream> stream,
+    const FFAVThreadOption& option) {
+    if (!initDecoder(stream, option))
         return false;
     return FFAVStream::initialize(context, stream);
 }
 
-bool FFAVDecodeStream::initDecoder(std::shared_ptr<AVStream> stream) {
+bool FFAVDecodeStream::initDecoder(std::shared_ptr<AVStream> stream, const FFAVThreadOption& option) {
     if (decoder_)
         return true;
 
@@ -334,6 +347,9 @@ bool FFAVDecodeStream::initDecoder(std::shared_ptr<AVStream> stream) {
         return false;
 
     decoder->SetTimeBase(stream->time_base);
+    if (!decoder->SetThreadOption(option))
+        return false;
+
     if (!decoder->Open())
         return false;
 
@@ -349,21 +365,37 @@ std::shared_ptr<FFAVDecoder> FFAVDecodeStream::GetDecoder() const {
     return decoder_;
 }
 
-bool FFAVDecodeStream::SendPacket(std::shared_ptr<AVPacket> packet) {
+bool FFAVDecodeStream::SendPacket(std::shared_ptr<AVPacket>&& packet) {
+    if (!packet)
+        return decoder_->SendPacket(nullptr);
+
     if (stream_->index != packet->stream_index)
         return false;
 
-    if (!decoder_->SendPacket(transformPacket(packet)))
+    int64_t begin = FFAVTracer::Begin();
+    int64_t pts = packet->pts;
+    packet = transformPacket(std::move(packet));
+    if (!packet)
         return false;
+    bool result = decoder_->SendPacket(std::move(packet));
+    FFAVTracer::End("SendPacket", begin, stream_->index, pts);
+    return result;
+}
 
-    return true;
+void FFAVDecodeStream::SetDiscardUntil(int64_t pts) {
+    decoder_->SetDiscardUntil(pts);
 }
 
 std::shared_ptr<AVFrame> FFAVDecodeStream::RecvFrame() {
+    int64_t begin = FFAVTracer::Begin();
     auto frame = decoder_->RecvFrame();
     if (!frame)
         return nullptr;
-    return transformFrame(frame);
+
+    frame = transformFrame(std::move(frame));
+    if (frame)
+        FFAVTracer::End("RecvFrame", begin, stream_->index, frame->pts);
+    return frame;
 }
 
 std::shared_ptr<FFAVEncodeStream> FFAVEncodeStream::Create(
@@ -388,6 +420,7 @@ bool FFAVEncodeStream::openEncoder() {
     if (!encoder_)
         return false;
 
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
     if (openencoded_.load())
         return true;
 
@@ -422,19 +455,29 @@ std::shared_ptr<FFAVEncoder> FFAVEncodeStream::GetEncoder() const {
     return encoder_;
 }
 
-bool FFAVEncodeStream::SendFrame(std::shared_ptr<AVFrame> frame) {
+bool FFAVEncodeStream::SendFrame(std::shared_ptr<AVFrame>&& frame) {
     if (!openEncoder())
         return false;
     if (encoder_->FrameEOF())
         return true;
-    return encoder_->SendFrame(transformFrame(frame));
+
+    int64_t begin = FFAVTracer::Begin();
+    int64_t pts = frame ? frame->pts : AV_NOPTS_VALUE;
+    if (frame) {
+        frame = transformFrame(std::move(frame));
+        if (!frame)
+            return false;
+    }
+    bool result = encoder_->SendFrame(std::move(frame));
+    FFAVTracer::End("SendFrame", begin, stream_->index, pts);
+    return result;
 }
 
 std::shared_ptr<AVPacket> FFAVEncodeStream::RecvPacket() {
     auto packet = encoder_->RecvPacket();
     if (!packet)
         return nullptr;
-    return transformPacket(packet);
+    return transformPacket(std::move(packet));
 }
 
 FFAVFormat::AVFormatInitPtr FFAVFormat::inited_ = FFAVFormat::AVFormatInitPtr(
@@ -447,7 +490,7 @@ FFAVFormat::AVFormatInitPtr FFAVFormat::inited_ = FFAVFormat::AVFormatInitPtr(
 );
 
 FFAVFormat::~FFAVFormat() {
-    std::cout << uri_ << " exit." << std::endl;
+    AVLogInfo(uri_, " exit.");
     exit_.store(true);
 }
 
@@ -489,13 +532,17 @@ std::shared_ptr<AVPacket> FFAVFormat::formatPacket(std::shared_ptr<AVPacket> pac
     if (!stream)
         return nullptr;
 
-    return stream->formatPacket(setStartTime(packet));
+    return stream->formatPacket(setStartTime(std::move(packet)));
 }
 
 std::shared_ptr<AVFormatContext> FFAVFormat::GetContext() const {
     return context_;
 }
 
+std::shared_ptr<FFAVIO> FFAVFormat::GetIO() const {
+    return io_;
+}
+
 std::string FFAVFormat::GetURI() const {
     return uri_;
 }
@@ -548,38 +595,55 @@ void FFAVFormat::DumpStreams() const {
     av_dump_format(context_.get(), 0, uri_.c_str(), is_output);
 }
 
-std::shared_ptr<FFAVDemuxer> FFAVDemuxer::Create(const std::string& uri) {
+std::shared_ptr<FFAVDemuxer> FFAVDemuxer::Create(const std::string& uri, std::shared_ptr<FFAVIO> io) {
     auto instance = std::shared_ptr<FFAVDemuxer>(new FFAVDemuxer());
-    if (!instance->initialize(uri))
+    if (!instance->initialize(uri, io))
         return nullptr;
     return instance;
 }
 
-bool FFAVDemuxer::initialize(const std::string& uri) {
+bool FFAVDemuxer::initialize(const std::string& uri, std::shared_ptr<FFAVIO> io) {
     AVFormatContext *context = nullptr;
+    if (io) {
+        context = avformat_alloc_context();
+        if (!context)
+            return false;
+        context->pb = io->GetContext().get();
+        context->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+
     int ret = avformat_open_input(&context, uri.c_str(), NULL, NULL);
     if (ret < 0) {
-        std::cerr << "avformat_open_input(" << uri << "): " << AVErrorStr(ret) << std::endl;
+        AVLogError("avformat_open_input(", uri, "): ", AVErrorStr(ret));
         return false;
     }
 
     ret = avformat_find_stream_info(context, NULL);
     if (ret < 0) {
-        std::cerr << "avformat_find_stream_info(" << uri << "): " << AVErrorStr(ret) << std::endl;
+        AVLogError("avformat_find_stream_info(", uri, "): ", AVErrorStr(ret));
         avformat_close_input(&context);
         return false;
     }
 
+    // The context keeps its custom IO alive, streams may outlive the demuxer.
     auto context_ptr = std::shared_ptr<AVFormatContext>(
         context,
-        [&](AVFormatContext* ctx) {
+        [io](AVFormatContext* ctx) {
             avformat_close_input(&ctx);
         }
     );
 
+    io_ = io;
     if (!initDemuxStreams(context_ptr))
         return false;
 
+    // Inputs read from caller memory or callbacks get no sidecar index.
+    if (fileBacked()) {
+        index_ = FFAVKeyIndex::Create(uri);
+        if (index_)
+            index_->Load();
+    }
+
     return FFAVFormat::initialize(uri, context_ptr);
 }
 
@@ -598,7 +662,7 @@ bool FFAVDemuxer::initDemuxStreams(std::shared_ptr<AVFormatContext> context) {
 
 bool FFAVDemuxer::setPacketEOF() {
     bool flushed = std::all_of(streams_.begin(), streams_.end(), [&](auto item) {
-        return item.second->flushStream();
+        return item.second->requestFlush();
     });
     if (!flushed)
         return false;
@@ -639,18 +703,21 @@ std::shared_ptr<FFAVStream> FFAVDemuxer::GetDemuxStream(int stream_index) const
     return GetStream(stream_index);
 }
 
-std::shared_ptr<FFAVDecodeStream> FFAVDemuxer::GetDecodeStream(int stream_index) {
+std::shared_ptr<FFAVDecodeStream> FFAVDemuxer::GetDecodeStream(int stream_index, const FFAVThreadOption& option) {
     auto demuxstream = GetStream(stream_index);
     if (!demuxstream)
         return nullptr;
 
     auto decodestream = std::dynamic_pointer_cast<FFAVDecodeStream>(demuxstream);
     if (!decodestream) {
-        decodestream = FFAVDecodeStream::Create(context_, demuxstream->GetStream());
+        decodestream = FFAVDecodeStream::Create(context_, demuxstream->GetStream(), option);
         if (!decodestream)
             return nullptr;
 
         decodestream->debug_.store(debug_.load());
+        decodestream->seek_pts_.store(demuxstream->seek_pts_.load());
+        if (accurate_seek_.load())
+            applySeekTarget(decodestream);
         streams_[stream_index] = decodestream;
     }
     return decodestream;
@@ -667,6 +734,7 @@ std::shared_ptr<AVPacket> FFAVDemuxer::ReadPacket() {
     if (PacketEOF())
         return nullptr;
 
+    int64_t begin = FFAVTracer::Begin();
     AVPacket *packet = av_packet_alloc();
     if (!packet)
         return nullptr;
@@ -680,19 +748,28 @@ std::shared_ptr<AVPacket> FFAVDemuxer::ReadPacket() {
             return nullptr;
         }
 
+        int64_t start = FFAVStats::Start();
         int ret = av_read_frame(context_.get(), packet);
         if (ret < 0) {
-            if (ret == AVERROR_EOF)
+            if (ret == AVERROR_EOF) {
+                if (index_ && indexing_.load() && !index_->IsComplete()) {
+                    index_->SetComplete(true);
+                    index_->Save();
+                }
                 setPacketEOF();
+            }
             av_packet_free(&packet);
             return nullptr;
         }
 
+        recordKeyframe(packet);
+
         auto stream = GetStream(packet->stream_index);
         if (!stream) {
             av_packet_unref(packet);
             continue;
         }
+        stream->stats_.Record(start, 1, packet->size);
 
         if (stream->ReachLimit()) {
             av_packet_unref(packet);
@@ -718,10 +795,13 @@ std::shared_ptr<AVPacket> FFAVDemuxer::ReadPacket() {
         break;
     }
 
-    return formatPacket(std::shared_ptr<AVPacket>(packet, [&](AVPacket *p) {
+    auto result = formatPacket(std::shared_ptr<AVPacket>(packet, [&](AVPacket *p) {
         av_packet_unref(p);
         av_packet_free(&p);
     }));
+    if (result)
+        FFAVTracer::End("ReadPacket", begin, result->stream_index, result->pts);
+    return result;
 }
 
 std::pair<int, std::shared_ptr<AVFrame>> FFAVDemuxer::ReadFrame() {
@@ -731,13 +811,27 @@ std::pair<int, std::shared_ptr<AVFrame>> FFAVDemuxer::ReadFrame() {
     int stream_index = -1;
     std::shared_ptr<AVFrame> frame;
     while (true) {
-        auto packet = ReadPacket();
+        auto packet = pending_packet_ ? std::move(pending_packet_) : ReadPacket();
         if (!packet) {
             if (!PacketEOF())
                 return { -1, nullptr };
         } else {
             auto stream = GetDecodeStream(packet->stream_index);
-            stream->SendPacket(packet);
+            if (!stream->SendPacket(std::move(packet))) {
+                if (!stream->GetDecoder()->InputFull())
+                    return { -1, nullptr };
+
+                // Hand out a frame of the full decoder, the packet waits.
+                pending_packet_ = std::move(packet);
+                frame = stream->RecvFrame();
+                if (frame) {
+                    stream_index = stream->GetIndex();
+                    break;
+                }
+                if (stream->GetDecoder()->InputFull())
+                    return { -1, nullptr };
+                continue;
+            }
         }
 
         auto stream = choseDecodeStream();
@@ -771,35 +865,299 @@ bool FFAVDemuxer::Seek(int stream_index, double timestamp) {
     } else {
         stream_index = -1;
     }
-    int ret = av_seek_frame(context_.get(), stream_index, timestamp_i, AVSEEK_FLAG_BACKWARD);
-    if (ret < 0)
+
+    pending_packet_ = nullptr;
+    // Lazily recorded entries must stay contiguous from the start. A target
+    // inside the recorded range lands on or before a known keyframe, so
+    // reading on extends the index; past it indexing pauses until a seek
+    // lands back inside.
+    FFAVIndexEntry entry;
+    bool covered = lookupIndex(stream_index, timestamp_i, entry);
+    indexing_.store(covered);
+    if (!covered || !seekIndex(entry)) {
+        int ret = av_seek_frame(context_.get(), stream_index, timestamp_i, AVSEEK_FLAG_BACKWARD);
+        if (ret < 0)
+            return false;
+    }
+
+    if (accurate_seek_.load()) {
+        seek_target_.store(int64_t(timestamp * AV_TIME_BASE));
+        for (auto& item : streams_)
+            applySeekTarget(item.second);
+    }
+    return true;
+}
+
+void FFAVDemuxer::SetAccurateSeek(bool accurate) {
+    accurate_seek_.store(accurate);
+}
+
+void FFAVDemuxer::applySeekTarget(std::shared_ptr<FFAVStream> stream) {
+    int64_t target = seek_target_.load();
+    if (target == AV_NOPTS_VALUE)
+        return;
+
+    int64_t pts = av_rescale_q(target, AV_TIME_BASE_Q, stream->GetTimeBase());
+    stream->seek_pts_.store(pts);
+
+    auto decodestream = std::dynamic_pointer_cast<FFAVDecodeStream>(stream);
+    if (decodestream) {
+        decodestream->GetDecoder()->Flush();
+        decodestream->SetDiscardUntil(pts);
+    }
+}
+
+bool FFAVDemuxer::BuildIndex() {
+    // The scan reads the file a second time, which needs a path to reopen.
+    if (!fileBacked()) {
+        AVLogError("BuildIndex(", uri_, "): no file behind the custom IO");
+        return false;
+    }
+    if (!index_)
+        return false;
+
+    if (index_->IsComplete())
+        return true;
+
+    AVFormatContext *context = nullptr;
+    int ret = avformat_open_input(&context, uri_.c_str(), NULL, NULL);
+    if (ret < 0) {
+        AVLogError("avformat_open_input(", uri_, "): ", AVErrorStr(ret));
+        return false;
+    }
+
+    auto context_ptr = std::shared_ptr<AVFormatContext>(context, [](AVFormatContext* ctx) {
+        avformat_close_input(&ctx);
+    });
+
+    ret = avformat_find_stream_info(context, NULL);
+    if (ret < 0) {
+        AVLogError("avformat_find_stream_info(", uri_, "): ", AVErrorStr(ret));
         return false;
+    }
+
+    AVPacket *packet = av_packet_alloc();
+    if (!packet)
+        return false;
+
+    while (true) {
+        ret = av_read_frame(context, packet);
+        if (ret < 0)
+            break;
+
+        if ((packet->flags & AV_PKT_FLAG_KEY) && packet->stream_index < int(context->nb_streams)) {
+            auto stream = context->streams[packet->stream_index];
+            int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+            index_->AddEntry(packet->stream_index, stream->time_base,
+                FFAVKeyIndex::IsIntraOnly(*stream->codecpar), { pts, packet->dts, packet->pos });
+        }
+        av_packet_unref(packet);
+    }
+    av_packet_free(&packet);
+
+    if (ret != AVERROR_EOF) {
+        AVLogError("av_read_frame(", uri_, "): ", AVErrorStr(ret));
+        return false;
+    }
+
+    index_->SetComplete(true);
+    index_->Save();
     return true;
 }
 
-std::shared_ptr<FFAVMuxer> FFAVMuxer::Create(const std::string& uri, const std::string& mux_fmt) {
+std::shared_ptr<FFAVKeyIndex> FFAVDemuxer::GetKeyIndex() const {
+    return index_;
+}
+
+void FFAVDemuxer::recordKeyframe(const AVPacket *packet) {
+    if (!index_ || !indexing_.load() || index_->IsComplete())
+        return;
+
+    if (!(packet->flags & AV_PKT_FLAG_KEY))
+        return;
+
+    auto stream = GetStream(packet->stream_index);
+    if (!stream)
+        return;
+
+    int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+    index_->AddEntry(packet->stream_index, stream->GetTimeBase(),
+        FFAVKeyIndex::IsIntraOnly(*stream->GetParameters()), { pts, packet->dts, packet->pos });
+}
+
+bool FFAVDemuxer::fileBacked() const {
+    return !std::dynamic_pointer_cast<FFAVMemoryIO>(io_) && !std::dynamic_pointer_cast<FFAVCallbackIO>(io_);
+}
+
+bool FFAVDemuxer::lookupIndex(int stream_index, int64_t timestamp, FFAVIndexEntry& entry) const {
+    if (!index_)
+        return false;
+
+    if (stream_index < 0) {
+        stream_index = av_find_default_stream_index(context_.get());
+        auto stream = GetStream(stream_index);
+        if (!stream)
+            return false;
+        timestamp = av_rescale_q(timestamp, AV_TIME_BASE_Q, stream->GetTimeBase());
+    }
+
+    return index_->Lookup(stream_index, timestamp, entry);
+}
+
+bool FFAVDemuxer::seekIndex(const FFAVIndexEntry& entry) {
+    // Only formats that resync from any offset, demuxers such as Matroska
+    // or mov keep their own seek tables and take the timestamp path.
+    const char *name = context_->iformat->name;
+    if (strcmp(name, "mpegts") != 0 && strcmp(name, "flv") != 0)
+        return false;
+
+    int ret = av_seek_frame(context_.get(), -1, entry.pos, AVSEEK_FLAG_BYTE);
+    if (ret < 0) {
+        AVLogError("av_seek_frame(", uri_, ", ", entry.pos, "): ", AVErrorStr(ret));
+        return false;
+    }
+    return true;
+}
+
+bool FFAVDemuxer::SetPacketSink(int stream_index, FFAVPacketSink sink, size_t batch_size) {
+    if (!GetStream(stream_index))
+        return false;
+
+    auto& item = sinks_[stream_index];
+    item.packet_sink = std::move(sink);
+    item.packet_batch = std::max<size_t>(batch_size, 1);
+    return true;
+}
+
+bool FFAVDemuxer::SetFrameSink(int stream_index, FFAVFrameSink sink, size_t batch_size) {
+    if (!GetDecodeStream(stream_index))
+        return false;
+
+    auto& item = sinks_[stream_index];
+    item.frame_sink = std::move(sink);
+    item.frame_batch = std::max<size_t>(batch_size, 1);
+    return true;
+}
+
+// Reads until max_packets were read, a sink pushes back or the input ends.
+// Frames are drained right from the decoder that took the packet.
+FFAVPumpStatus FFAVDemuxer::Pump(size_t max_packets) {
+    auto status = deliverSinks(false);
+    if (status != FFAVPumpStatus::Again)
+        return status;
+
+    size_t count = 0;
+    while (max_packets == 0 || count < max_packets) {
+        auto packet = ReadPacket();
+        if (!packet) {
+            if (!PacketEOF())
+                return FFAVPumpStatus::Error;
+            return finishSinks();
+        }
+
+        count++;
+        int stream_index = packet->stream_index;
+        auto it = sinks_.find(stream_index);
+        if (it == sinks_.end())
+            continue;
+
+        auto& sink = it->second;
+        if (sink.frame_sink) {
+            auto stream = GetDecodeStream(stream_index);
+            auto input = sink.packet_sink ? packet : std::move(packet);
+            while (!stream->SendPacket(std::move(input))) {
+                if (!stream->GetDecoder()->InputFull())
+                    return FFAVPumpStatus::Error;
+                auto frame = stream->RecvFrame();
+                if (frame)
+                    sink.frames.push_back(std::move(frame));
+                else if (stream->GetDecoder()->InputFull())
+                    return FFAVPumpStatus::Error;
+            }
+            while (auto frame = stream->RecvFrame())
+                sink.frames.push_back(std::move(frame));
+        }
+        if (sink.packet_sink && packet)
+            sink.packets.push_back(std::move(packet));
+
+        status = deliverSink(stream_index, sink, false);
+        if (status != FFAVPumpStatus::Again)
+            return status;
+    }
+    return deliverSinks(true);
+}
+
+FFAVPumpStatus FFAVDemuxer::deliverSink(int stream_index, StreamSink& sink, bool partial) {
+    auto result = FFAVSinkStatus::Accepted;
+    if (!sink.packets.empty() && (partial || sink.packets.size() >= sink.packet_batch)) {
+        result = sink.packet_sink(stream_index, sink.packets);
+        if (result == FFAVSinkStatus::Busy)
+            return FFAVPumpStatus::Busy;
+        sink.packets.clear();
+        if (result == FFAVSinkStatus::Stop)
+            return FFAVPumpStatus::Stopped;
+    }
+
+    if (!sink.frames.empty() && (partial || sink.frames.size() >= sink.frame_batch)) {
+        result = sink.frame_sink(stream_index, sink.frames);
+        if (result == FFAVSinkStatus::Busy)
+            return FFAVPumpStatus::Busy;
+        sink.frames.clear();
+        if (result == FFAVSinkStatus::Stop)
+            return FFAVPumpStatus::Stopped;
+    }
+    return FFAVPumpStatus::Again;
+}
+
+FFAVPumpStatus FFAVDemuxer::deliverSinks(bool partial) {
+    for (auto& [stream_index, sink] : sinks_) {
+        auto status = deliverSink(stream_index, sink, partial);
+        if (status != FFAVPumpStatus::Again)
+            return status;
+    }
+    return FFAVPumpStatus::Again;
+}
+
+FFAVPumpStatus FFAVDemuxer::finishSinks() {
+    for (auto& [stream_index, sink] : sinks_) {
+        if (!sink.frame_sink || sink.flushed)
+            continue;
+
+        auto stream = GetDecodeStream(stream_index);
+        stream->SendPacket(nullptr);
+        while (auto frame = stream->RecvFrame())
+            sink.frames.push_back(std::move(frame));
+        sink.flushed = true;
+    }
+
+    auto status = deliverSinks(true);
+    return status == FFAVPumpStatus::Again ? FFAVPumpStatus::End : status;
+}
+
+std::shared_ptr<FFAVMuxer> FFAVMuxer::Create(const std::string& uri, const std::string& mux_fmt, std::shared_ptr<FFAVIO> io) {
     auto instance = std::shared_ptr<FFAVMuxer>(new FFAVMuxer());
-    if (!instance->initialize(uri, mux_fmt))
+    if (!instance->initialize(uri, mux_fmt, io))
         return nullptr;
     return instance;
 }
 
-bool FFAVMuxer::initialize(const std::string& uri, const std::string& mux_fmt) {
+bool FFAVMuxer::initialize(const std::string& uri, const std::string& mux_fmt, std::shared_ptr<FFAVIO> io) {
     AVFormatContext *context = nullptr;
     const char *filename = uri.empty() ? NULL : uri.c_str();
     const char *format_name = mux_fmt.empty() ? NULL : mux_fmt.c_str();
     int ret = avformat_alloc_output_context2(&context, nullptr, format_name, filename);
     if (ret < 0) {
-        std::cerr << "avformat_alloc_output_context2(" << format_name
-            << ", " << filename
-            << "): " << AVErrorStr(ret) << std::endl;
+        AVLogError("avformat_alloc_output_context2(", format_name,
+            ", ", filename,
+            "): ", AVErrorStr(ret));
         return false;
     }
 
+    io_ = io;
     return FFAVFormat::initialize(uri, std::shared_ptr<AVFormatContext>(
         context,
-        [&](AVFormatContext* ctx) {
-            if (openmuxed_.load()) {
+        [&, io](AVFormatContext* ctx) {
+            if (openmuxed_.load() && !(ctx->flags & AVFMT_FLAG_CUSTOM_IO)) {
                 if (!(ctx->oformat->flags & AVFMT_NOFILE)) {
                     avio_closep(&ctx->pb);
                 }
@@ -815,14 +1173,20 @@ bool FFAVMuxer::openMuxer() {
 
     for (const auto& item : streams_) {
         auto stream = GetEncodeStream(item.first);
-        if (!stream->openEncoder())
+        if (stream && !stream->openEncoder())
             return false;
     }
 
-    if (!(context_->oformat->flags & AVFMT_NOFILE)) {
+    if (segmenting_.load()) {
+        if (!openSegment(AV_NOPTS_VALUE))
+            return false;
+    } else if (io_ && !(context_->oformat->flags & AVFMT_NOFILE)) {
+        context_->pb = io_->GetContext().get();
+        context_->flags |= AVFMT_FLAG_CUSTOM_IO;
+    } else if (!(context_->oformat->flags & AVFMT_NOFILE)) {
         int ret = avio_open2(&context_->pb, uri_.c_str(), AVIO_FLAG_WRITE, nullptr, nullptr);
         if (ret < 0) {
-            std::cerr << "avio_open2(" << uri_ << "): " << AVErrorStr(ret) << std::endl;
+            AVLogError("avio_open2(", uri_, "): ", AVErrorStr(ret));
             return false;
         }
     }
@@ -831,18 +1195,19 @@ bool FFAVMuxer::openMuxer() {
     return true;
 }
 
-bool FFAVMuxer::writeHeader() {
+bool FFAVMuxer::WriteHeader() {
     if (headmuxed_.load())
         return true;
 
     if (!openMuxer())
         return false;
 
+    std::ostringstream header;
     if (debug_.load()) {
-        std::cout << "[W:Header]";
+        header << "[W:Header]";
         for (auto& [stream_index, stream] : streams_) {
             auto rawstream = stream->GetStream();
-            std::cout << std::fixed << std::setprecision(6)
+            header << std::fixed << std::setprecision(6)
                 << " index:" << stream_index
                 << " time_base:" << rawstream->time_base.den;
         }
@@ -855,20 +1220,20 @@ bool FFAVMuxer::writeHeader() {
 
     int ret = avformat_write_header(context_.get(), nullptr);
     if (ret < 0) {
-        std::cerr << "avformat_write_header: " << AVErrorStr(ret) << std::endl;
+        AVLogError("avformat_write_header: ", AVErrorStr(ret));
         return false;
     }
 
     if (debug_.load()) {
-        std::cout << " ->";
+        header << " ->";
         for (auto& [stream_index, stream] : streams_) {
             auto rawstream = stream->GetStream();
-            std::cout << std::fixed << std::setprecision(6)
+            header << std::fixed << std::setprecision(6)
                 << " index:" << stream_index
                 << " time_base:" << av_q2d(rawstream->time_base)
                 << " (" << rawstream->time_base.den << ")";
         }
-        std::cout << std::endl;
+        AVLogDebug(header.str());
     }
 
     for (const auto& [stream_index, stream] : streams_) {
@@ -891,14 +1256,26 @@ bool FFAVMuxer::writeTrailer() {
 
     int ret = av_write_trailer(context_.get());
     if (ret < 0) {
-        std::cerr << "av_write_trailer: " << AVErrorStr(ret) << std::endl;
+        AVLogError("av_write_trailer: ", AVErrorStr(ret));
+        return false;
+    }
+
+    if (segmenting_.load()) {
+        int64_t end_time = segment_end_ != AV_NOPTS_VALUE ? segment_end_ : segment_start_;
+        closing_.push_back({ { segment_uri_, (end_time - segment_start_) / double(AV_TIME_BASE) }, segment_io_ });
+        segment_io_ = nullptr;
+        if (!closeSegments(true))
+            return false;
+    }
+
+    // Write-behind output only reports its pwrite errors once drained.
+    if (io_ && !io_->Close()) {
+        AVLogError("close(", uri_, "): write failed");
         return false;
     }
 
     if (debug_.load()) {
-        std::cout << "[W:Tailer]"
-            << "streams:" << streams_.size()
-            << std::endl;
+        AVLogDebug("[W:Tailer]", "streams:", streams_.size());
     }
     trailmuxed_.store(true);
     return true;
@@ -1013,26 +1390,215 @@ bool FFAVMuxer::SetMetadata(const std::unordered_map<std::string, std::string>&
     return true;
 }
 
+// The pattern is used as a printf format with the segment number as the only
+// argument, so it must hold exactly one int conversion and nothing else.
+static bool validSegmentPattern(const std::string& pattern) {
+    int conversions = 0;
+    for (size_t i = 0; i < pattern.size(); i++) {
+        if (pattern[i] != '%')
+            continue;
+        if (++i < pattern.size() && pattern[i] == '%')
+            continue;
+
+        i = pattern.find_first_not_of("-+ #0123456789.", i);
+        if (i == std::string::npos || !strchr("diu", pattern[i]))
+            return false;
+        conversions++;
+    }
+    return conversions == 1;
+}
+
+bool FFAVMuxer::SetSegmentOption(const FFAVSegmentOption& option) {
+    if (openmuxed_.load() || io_ || option.duration <= 0)
+        return false;
+
+    // Segments are cut by swapping the output of a running muxer, which only
+    // mpegts tolerates, it re-sends PAT/PMT at the start of each segment.
+    if (strcmp(context_->oformat->name, "mpegts") != 0) {
+        AVLogError("SetSegmentOption(", uri_, "): unsupported format ",
+            context_->oformat->name);
+        return false;
+    }
+
+    segment_option_ = option;
+    if (segment_option_.pattern.empty()) {
+        auto path = AVIOPath(uri_);
+        auto dot = path.rfind('.');
+        if (dot != std::string::npos && path.find('/', dot) == std::string::npos)
+            path = path.substr(0, dot);
+        segment_option_.pattern = path + "_%05d.ts";
+    }
+    if (!validSegmentPattern(segment_option_.pattern)) {
+        AVLogError("SetSegmentOption(", uri_, "): invalid pattern ", segment_option_.pattern);
+        return false;
+    }
+    segmenting_.store(true);
+    return true;
+}
+
+std::vector<FFAVSegment> FFAVMuxer::GetSegments() const {
+    return segments_;
+}
+
+bool FFAVMuxer::cutSegment(const AVPacket *packet) {
+    if (segment_stream_ < 0) {
+        segment_stream_ = av_find_best_stream(context_.get(), AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+        if (segment_stream_ < 0)
+            segment_stream_ = packet->stream_index;
+    }
+
+    if (packet->stream_index != segment_stream_ || packet->pts == AV_NOPTS_VALUE)
+        return true;
+
+    auto time_base = GetMuxStream(packet->stream_index)->GetTimeBase();
+    int64_t pts = av_rescale_q(packet->pts, time_base, AV_TIME_BASE_Q);
+    int64_t end = pts + av_rescale_q(packet->duration, time_base, AV_TIME_BASE_Q);
+    if (segment_start_ == AV_NOPTS_VALUE)
+        segment_start_ = pts;
+
+    bool cut = (packet->flags & AV_PKT_FLAG_KEY)
+        && pts - segment_start_ >= int64_t(segment_option_.duration * AV_TIME_BASE);
+    if (cut && !openSegment(pts))
+        return false;
+
+    segment_end_ = std::max(segment_end_ == AV_NOPTS_VALUE ? end : segment_end_, end);
+    return true;
+}
+
+bool FFAVMuxer::openSegment(int64_t start_time) {
+    if (segment_io_) {
+        // Drain the interleaving queue so the old segment ends before the cut.
+        int ret = av_interleaved_write_frame(context_.get(), nullptr);
+        if (ret < 0) {
+            AVLogError("av_interleaved_write_frame(", segment_uri_, "): ", AVErrorStr(ret));
+            return false;
+        }
+        // mpegts buffers PES data until it is asked to flush.
+        ret = av_write_frame(context_.get(), nullptr);
+        if (ret < 0) {
+            AVLogError("av_write_frame(", segment_uri_, "): ", AVErrorStr(ret));
+            return false;
+        }
+        avio_flush(context_->pb);
+        closing_.push_back({ { segment_uri_, (start_time - segment_start_) / double(AV_TIME_BASE) }, segment_io_ });
+        av_opt_set(context_->priv_data, "mpegts_flags", "+resend_headers", 0);
+    }
+
+    char uri[1024];
+    int len = snprintf(uri, sizeof(uri), segment_option_.pattern.c_str(), segment_number_);
+    if (len < 0 || len >= int(sizeof(uri))) {
+        AVLogError("openSegment(", uri_, "): segment uri too long");
+        return false;
+    }
+    auto io = FFAVWriteIO::Create(uri, segment_option_.write_behind);
+    if (!io)
+        return false;
+
+    context_->pb = io->GetContext().get();
+    context_->flags |= AVFMT_FLAG_CUSTOM_IO;
+    segment_io_ = io;
+    segment_uri_ = uri;
+    segment_start_ = start_time;
+    segment_number_++;
+
+    // The previous segment keeps flushing while the next one fills, it is
+    // only waited for at the following cut.
+    return closeSegments(false);
+}
+
+bool FFAVMuxer::closeSegments(bool final) {
+    bool updated = false;
+    while (closing_.size() > (final ? 0 : 1)) {
+        auto [segment, io] = closing_.front();
+        closing_.pop_front();
+        if (!io->Close()) {
+            AVLogError("close(", segment.uri, "): write failed");
+            return false;
+        }
+        segments_.push_back(segment);
+        updated = true;
+    }
+
+    if (updated || final)
+        return writePlaylist(final);
+    return true;
+}
+
+bool FFAVMuxer::writePlaylist(bool final) const {
+    double target = segment_option_.duration;
+    for (const auto& segment : segments_)
+        target = std::max(target, segment.duration);
+
+    auto path = AVIOPath(uri_);
+    auto dir = path.substr(0, path.rfind('/') + 1);
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::trunc);
+        if (!out)
+            return false;
+
+        out << "#EXTM3U\n"
+            << "#EXT-X-VERSION:3\n"
+            << "#EXT-X-TARGETDURATION:" << int64_t(std::ceil(target)) << "\n"
+            << "#EXT-X-MEDIA-SEQUENCE:0\n";
+        if (final)
+            out << "#EXT-X-PLAYLIST-TYPE:VOD\n";
+        for (const auto& segment : segments_) {
+            auto name = segment.uri;
+            if (!dir.empty() && name.rfind(dir, 0) == 0)
+                name = name.substr(dir.size());
+            out << "#EXTINF:" << std::fixed << std::setprecision(6) << segment.duration << ",\n"
+                << name << "\n";
+        }
+        if (final)
+            out << "#EXT-X-ENDLIST\n";
+        if (!out.flush()) {
+            std::remove(tmp_path.c_str());
+            return false;
+        }
+    }
+
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        AVLogError("rename(", path, "): ", strerror(errno));
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
 bool FFAVMuxer::WritePacket(std::shared_ptr<AVPacket> packet) {
     if (!packet)
         return setPacketEOF();
 
-    if (!writeHeader())
+    if (!WriteHeader())
         return false;
 
     auto stream = GetMuxStream(packet->stream_index);
     if (stream->ReachLimit())
         return true;
 
-    packet = formatPacket(packet);
+    int64_t begin = FFAVTracer::Begin();
+    int stream_index = packet->stream_index;
+    int64_t pts = packet->pts;
+
+    packet = formatPacket(std::move(packet));
     if (!packet)
         return false;
 
+    if (segmenting_.load() && !cutSegment(packet.get()))
+        return false;
+
+    int64_t start = FFAVStats::Start();
+    int64_t write_begin = FFAVTracer::Begin();
+    int size = packet->size;
     int ret = av_interleaved_write_frame(context_.get(), packet.get());
+    FFAVTracer::End("av_interleaved_write_frame", write_begin, stream_index, pts);
     if (ret < 0) {
-        std::cerr << "av_interleaved_write_frame: " << AVErrorStr(ret) << std::endl;
+        AVLogError("av_interleaved_write_frame: ", AVErrorStr(ret));
         return false;
     }
+    stream->stats_.Record(start, 1, size);
+    FFAVTracer::End("WritePacket", begin, stream_index, pts);
     return true;
 }
 
@@ -1047,8 +1613,15 @@ bool FFAVMuxer::WriteFrame(int stream_index, std::shared_ptr<AVFrame> frame) {
         }
     }
 
-    if (frame && !stream->SendFrame(frame))
-        return false;
+    while (frame && !stream->SendFrame(std::move(frame))) {
+        if (!stream->GetEncoder()->InputFull())
+            return false;
+        auto packet = stream->RecvPacket();
+        if (packet && !WritePacket(std::move(packet)))
+            return false;
+        if (!packet && stream->GetEncoder()->InputFull())
+            return false;
+    }
 
     while (true) {
         auto stream = choseEncodeStream();
@@ -1065,7 +1638,7 @@ bool FFAVMuxer::WriteFrame(int stream_index, std::shared_ptr<AVFrame> frame) {
             return false;
         }
 
-        if (!WritePacket(packet))
+        if (!WritePacket(std::move(packet)))
             return false;
     }
     return true;
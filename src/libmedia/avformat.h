@@ -12,6 +12,9 @@
 #include <unordered_set>
 #include "avutil.h"
 #include "avcodec.h"
+#include "avindex.h"
+#include "avio.h"
+#include "avstats.h"
 extern "C" {
 #define __STDC_CONSTANT_MACROS
 #include <libavformat/avformat.h>
@@ -30,11 +33,13 @@ public:
     uint64_t GetPacketCount() const;
     std::string GetMetadata(const std::string& metakey) const;
     bool ReachLimit() const;
+    FFAVStatsSnapshot GetStats() const;
     bool SetMetadata(const std::unordered_map<std::string, std::string>& metadata);
     bool SetParameters(const AVCodecParameters& params);
     bool SetDesiredTimeBase(const AVRational& time_base);
     void SetDuration(double duration);
     void SetDebug(bool debug);
+    void SetDeferredFlush(bool deferred);
     virtual ~FFAVStream() = default;
 
 protected:
@@ -43,6 +48,7 @@ protected:
         std::shared_ptr<AVFormatContext> context,
         std::shared_ptr<AVStream> stream);
     virtual bool flushStream();
+    bool requestFlush();
     int64_t getPacketDts() const;
     int64_t getFramePts() const;
     void setFmtStartTime(int64_t start_time);
@@ -57,6 +63,7 @@ protected:
 protected:
     std::atomic_bool debug_{false};
     std::atomic_bool reached_limit_{false};
+    std::atomic_bool deferred_flush_{false};
     std::atomic_int64_t packet_count_{0};
     std::atomic_int64_t limit_duration_{0};
     std::atomic_int64_t pkt_duration_{0};
@@ -65,8 +72,10 @@ protected:
     std::atomic_int64_t first_dts_{AV_NOPTS_VALUE};
     std::atomic_int64_t packet_dts_{AV_NOPTS_VALUE};
     std::atomic_int64_t frame_pts_{AV_NOPTS_VALUE};
+    std::atomic_int64_t seek_pts_{AV_NOPTS_VALUE};
     std::shared_ptr<AVStream> stream_;
     std::shared_ptr<AVFormatContext> context_;
+    FFAVStats stats_;
     friend class FFAVFormat;
     friend class FFAVDemuxer;
     friend class FFAVMuxer;
@@ -76,19 +85,23 @@ class FFAVDecodeStream : public FFAVStream {
 public:
     static std::shared_ptr<FFAVDecodeStream> Create(
         std::shared_ptr<AVFormatContext> context,
-        std::shared_ptr<AVStream> stream);
+        std::shared_ptr<AVStream> stream,
+        const FFAVThreadOption& option = {});
     std::shared_ptr<FFAVDecoder> GetDecoder() const;
     bool SetParameters(const AVCodecParameters& params) = delete;
     bool SetDesiredTimeBase(const AVRational& time_base) = delete;
-    bool SendPacket(std::shared_ptr<AVPacket> packet);
+    // Like FFAVDecoder::SendPacket, a refused packet stays with the caller.
+    bool SendPacket(std::shared_ptr<AVPacket>&& packet);
     std::shared_ptr<AVFrame> RecvFrame();
+    void SetDiscardUntil(int64_t pts);
 
 private:
     FFAVDecodeStream() = default;
     bool initialize(
         std::shared_ptr<AVFormatContext> context,
-        std::shared_ptr<AVStream> stream);
-    bool initDecoder(std::shared_ptr<AVStream> stream);
+        std::shared_ptr<AVStream> stream,
+        const FFAVThreadOption& option);
+    bool initDecoder(std::shared_ptr<AVStream> stream, const FFAVThreadOption& option);
     bool flushStream() override;
 
 private:
@@ -103,7 +116,8 @@ public:
         std::shared_ptr<FFAVEncoder> encoder);
     std::shared_ptr<FFAVEncoder> GetEncoder() const;
     bool SetParameters(const AVCodecParameters& params) = delete;
-    bool SendFrame(std::shared_ptr<AVFrame> frame);
+    // Like FFAVEncoder::SendFrame, a refused frame stays with the caller.
+    bool SendFrame(std::shared_ptr<AVFrame>&& frame);
     std::shared_ptr<AVPacket> RecvPacket();
 
 private:
@@ -116,6 +130,7 @@ private:
     bool flushStream() override;
 
 private:
+    mutable std::recursive_mutex mutex_;
     std::atomic_bool openencoded_{false};
     std::shared_ptr<FFAVEncoder> encoder_;
     friend class FFAVMuxer;
@@ -129,6 +144,7 @@ protected:
 public:
     virtual ~FFAVFormat();
     std::shared_ptr<AVFormatContext> GetContext() const;
+    std::shared_ptr<FFAVIO> GetIO() const;
     std::string GetURI() const;
     std::vector<int> GetStreamIndexes() const;
     std::shared_ptr<FFAVStream> GetStream(int stream_index) const;
@@ -157,51 +173,137 @@ protected:
     std::atomic_int64_t first_dts_{AV_NOPTS_VALUE};
     std::atomic_int64_t real_starttime_{0};
     std::atomic_int64_t play_speed_{AV_TIME_BASE};
+    std::shared_ptr<FFAVIO> io_;
     std::shared_ptr<AVFormatContext> context_;
     FFAVStreamMap streams_;
 };
 
+// Returned by sinks: Busy keeps the batch for the next Pump, Stop ends it.
+enum class FFAVSinkStatus {
+    Accepted,
+    Busy,
+    Stop,
+};
+
+enum class FFAVPumpStatus {
+    Again,
+    Busy,
+    Stopped,
+    End,
+    Error,
+};
+
+// Batches are only valid during the call, sinks move out what they keep.
+using FFAVPacketSink = std::function<FFAVSinkStatus(int, std::vector<std::shared_ptr<AVPacket>>&)>;
+using FFAVFrameSink = std::function<FFAVSinkStatus(int, std::vector<std::shared_ptr<AVFrame>>&)>;
+
 class FFAVDemuxer final : public FFAVFormat {
+    struct StreamSink {
+        FFAVPacketSink packet_sink;
+        FFAVFrameSink frame_sink;
+        size_t packet_batch{1};
+        size_t frame_batch{1};
+        bool flushed{false};
+        std::vector<std::shared_ptr<AVPacket>> packets;
+        std::vector<std::shared_ptr<AVFrame>> frames;
+    };
+
 public:
-    static std::shared_ptr<FFAVDemuxer> Create(const std::string& uri);
+    static std::shared_ptr<FFAVDemuxer> Create(const std::string& uri, std::shared_ptr<FFAVIO> io = nullptr);
     std::shared_ptr<FFAVStream> GetDemuxStream(int stream_index) const;
-    std::shared_ptr<FFAVDecodeStream> GetDecodeStream(int stream_index);
+    std::shared_ptr<FFAVDecodeStream> GetDecodeStream(int stream_index, const FFAVThreadOption& option = {});
     std::string GetMetadata(const std::string& metakey) const;
     std::shared_ptr<AVPacket> ReadPacket();
     std::pair<int, std::shared_ptr<AVFrame>> ReadFrame();
     bool Seek(int stream_index, double timestamp);
+    void SetAccurateSeek(bool accurate);
+    bool BuildIndex();
+    std::shared_ptr<FFAVKeyIndex> GetKeyIndex() const;
+    bool SetPacketSink(int stream_index, FFAVPacketSink sink, size_t batch_size = 1);
+    bool SetFrameSink(int stream_index, FFAVFrameSink sink, size_t batch_size = 1);
+    FFAVPumpStatus Pump(size_t max_packets = 0);
 
 private:
     FFAVDemuxer() = default;
-    bool initialize(const std::string& uri);
+    bool initialize(const std::string& uri, std::shared_ptr<FFAVIO> io);
     bool initDemuxStreams(std::shared_ptr<AVFormatContext> context);
     bool setPacketEOF();
     std::shared_ptr<FFAVDecodeStream> choseDecodeStream();
+    void recordKeyframe(const AVPacket *packet);
+    bool fileBacked() const;
+    bool lookupIndex(int stream_index, int64_t timestamp, FFAVIndexEntry& entry) const;
+    bool seekIndex(const FFAVIndexEntry& entry);
+    void applySeekTarget(std::shared_ptr<FFAVStream> stream);
+    FFAVPumpStatus deliverSink(int stream_index, StreamSink& sink, bool partial);
+    FFAVPumpStatus deliverSinks(bool partial);
+    FFAVPumpStatus finishSinks();
+
+private:
+    std::map<int, StreamSink> sinks_;
+    // Read but refused by a full decoder, ReadFrame sends it first next time.
+    std::shared_ptr<AVPacket> pending_packet_;
+    std::atomic_bool indexing_{true};
+    std::atomic_bool accurate_seek_{false};
+    std::atomic_int64_t seek_target_{AV_NOPTS_VALUE};
+    std::shared_ptr<FFAVKeyIndex> index_;
+};
+
+// duration: target seconds per segment, cuts land on the next keyframe of
+// the first video stream. pattern: printf pattern of segment uris with a
+// single %d style conversion for the segment number, defaults to the
+// playlist uri without extension plus "_%05d.ts".
+struct FFAVSegmentOption {
+    double duration{6.0};
+    std::string pattern;
+    FFAVWriteBehindOption write_behind;
+};
+
+struct FFAVSegment {
+    std::string uri;
+    double duration;
 };
 
 class FFAVMuxer final : public FFAVFormat {
+    using FFAVSegmentIO = std::pair<FFAVSegment, std::shared_ptr<FFAVIO>>;
+
 public:
-    static std::shared_ptr<FFAVMuxer> Create(const std::string& uri, const std::string& mux_fmt);
+    static std::shared_ptr<FFAVMuxer> Create(const std::string& uri, const std::string& mux_fmt, std::shared_ptr<FFAVIO> io = nullptr);
     std::shared_ptr<FFAVStream> GetMuxStream(int stream_index) const;
     std::shared_ptr<FFAVEncodeStream> GetEncodeStream(int stream_index) const;
     std::shared_ptr<FFAVStream> AddMuxStream();
     std::shared_ptr<FFAVEncodeStream> AddEncodeStream(AVCodecID codec_id);
     bool SetMetadata(const std::unordered_map<std::string, std::string>& metadata);
+    bool SetSegmentOption(const FFAVSegmentOption& option);
+    std::vector<FFAVSegment> GetSegments() const;
+    bool WriteHeader();
     bool WritePacket(std::shared_ptr<AVPacket> packet);
     bool WriteFrame(int stream_index, std::shared_ptr<AVFrame> frame);
 
 private:
     FFAVMuxer() = default;
-    bool initialize(const std::string& uri, const std::string& mux_fmt);
+    bool initialize(const std::string& uri, const std::string& mux_fmt, std::shared_ptr<FFAVIO> io);
     bool openMuxer();
-    bool writeHeader();
     bool writeTrailer();
     bool setPacketEOF();
     bool setFrameEOF(std::shared_ptr<FFAVEncodeStream> stream);
     std::shared_ptr<FFAVEncodeStream> choseEncodeStream();
+    bool cutSegment(const AVPacket *packet);
+    bool openSegment(int64_t start_time);
+    bool closeSegments(bool final);
+    bool writePlaylist(bool final) const;
 
 private:
     std::atomic_bool openmuxed_{false};
     std::atomic_bool headmuxed_{false};
     std::atomic_bool trailmuxed_{false};
+    std::atomic_bool segmenting_{false};
+    FFAVSegmentOption segment_option_;
+    int segment_stream_{-1};
+    int segment_number_{0};
+    int64_t segment_start_{AV_NOPTS_VALUE};
+    int64_t segment_end_{AV_NOPTS_VALUE};
+    std::string segment_uri_;
+    std::shared_ptr<FFAVIO> segment_io_;
+    std::deque<FFAVSegmentIO> closing_;
+    std::vector<FFAVSegment> segments_;
 };
@@ -0,0 +1,203 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+#include "avindex.h"
+
+static const char kIndexMagic[4] = { 'F', 'F', 'I', 'X' };
+static const uint32_t kIndexVersion = 1;
+
+template <typename T>
+static bool readValue(std::ifstream& in, T& value) {
+    return bool(in.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+template <typename T>
+static bool writeValue(std::ofstream& out, const T& value) {
+    return bool(out.write(reinterpret_cast<const char*>(&value), sizeof(value)));
+}
+
+std::shared_ptr<FFAVKeyIndex> FFAVKeyIndex::Create(const std::string& uri) {
+    auto instance = std::shared_ptr<FFAVKeyIndex>(new FFAVKeyIndex());
+    if (!instance->initialize(uri))
+        return nullptr;
+    return instance;
+}
+
+bool FFAVKeyIndex::initialize(const std::string& uri) {
+    const char *protocol = avio_find_protocol_name(uri.c_str());
+    if (!protocol || strcmp(protocol, "file") != 0)
+        return false;
+
+    uri_ = uri;
+    if (uri_.rfind("file:", 0) == 0)
+        uri_ = uri_.substr(5);
+    path_ = uri_ + ".ffidx";
+    return true;
+}
+
+std::string FFAVKeyIndex::GetPath() const {
+    return path_;
+}
+
+bool FFAVKeyIndex::IsComplete() const {
+    return complete_.load();
+}
+
+void FFAVKeyIndex::SetComplete(bool complete) {
+    complete_.store(complete);
+}
+
+size_t FFAVKeyIndex::GetEntryCount(int stream_index) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(stream_index);
+    if (it == entries_.end())
+        return 0;
+    return it->second.size();
+}
+
+std::vector<FFAVIndexEntry> FFAVKeyIndex::GetEntries(int stream_index) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(stream_index);
+    if (it == entries_.end())
+        return {};
+    return it->second;
+}
+
+bool FFAVKeyIndex::IsIntraOnly(const AVCodecParameters& params) {
+    if (params.codec_type == AVMEDIA_TYPE_AUDIO)
+        return true;
+
+    const AVCodecDescriptor *desc = avcodec_descriptor_get(params.codec_id);
+    return desc && (desc->props & AV_CODEC_PROP_INTRA_ONLY);
+}
+
+void FFAVKeyIndex::AddEntry(int stream_index, AVRational time_base, bool intra_only, const FFAVIndexEntry& entry) {
+    if (entry.pts == AV_NOPTS_VALUE || entry.pos < 0)
+        return;
+
+    int64_t interval = intra_only ? av_rescale_q(AV_TIME_BASE, AV_TIME_BASE_Q, time_base) : 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& entries = entries_[stream_index];
+    if (!entries.empty()) {
+        const auto& last = entries.back();
+        if (entry.pts <= last.pts || entry.pts - last.pts < interval)
+            return;
+    }
+    entries.push_back(entry);
+}
+
+bool FFAVKeyIndex::Lookup(int stream_index, int64_t timestamp, FFAVIndexEntry& entry) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(stream_index);
+    if (it == entries_.end() || it->second.empty())
+        return false;
+
+    const auto& entries = it->second;
+    auto next = std::upper_bound(entries.begin(), entries.end(), timestamp,
+        [](int64_t ts, const FFAVIndexEntry& item) {
+            return ts < item.pts;
+        });
+    if (next == entries.begin())
+        return false;
+
+    // A partial index only knows there is no later keyframe before the
+    // target when it already recorded one past it.
+    if (next == entries.end() && !complete_.load())
+        return false;
+
+    entry = *std::prev(next);
+    return true;
+}
+
+bool FFAVKeyIndex::statInput(int64_t& size, int64_t& mtime) const {
+    struct stat st;
+    if (stat(uri_.c_str(), &st) != 0)
+        return false;
+
+    size = st.st_size;
+    mtime = st.st_mtime;
+    return true;
+}
+
+bool FFAVKeyIndex::Load() {
+    int64_t size = 0, mtime = 0;
+    if (!statInput(size, mtime))
+        return false;
+
+    std::ifstream in(path_, std::ios::binary);
+    if (!in)
+        return false;
+
+    char magic[4];
+    uint32_t version = 0;
+    int64_t index_size = 0, index_mtime = 0;
+    uint32_t nb_streams = 0;
+    if (!in.read(magic, sizeof(magic)) || memcmp(magic, kIndexMagic, sizeof(magic)) != 0)
+        return false;
+    if (!readValue(in, version) || version != kIndexVersion)
+        return false;
+    if (!readValue(in, index_size) || !readValue(in, index_mtime) || !readValue(in, nb_streams))
+        return false;
+    if (index_size != size || index_mtime != mtime)
+        return false;
+
+    std::map<int, std::vector<FFAVIndexEntry>> entries;
+    for (uint32_t i = 0; i < nb_streams; i++) {
+        int32_t stream_index = 0;
+        uint32_t count = 0;
+        if (!readValue(in, stream_index) || !readValue(in, count))
+            return false;
+        if (count > size / sizeof(FFAVIndexEntry))
+            return false;
+
+        auto& items = entries[stream_index];
+        items.resize(count);
+        if (!in.read(reinterpret_cast<char*>(items.data()), count * sizeof(FFAVIndexEntry)))
+            return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_ = std::move(entries);
+    complete_.store(true);
+    return true;
+}
+
+bool FFAVKeyIndex::Save() const {
+    if (!complete_.load())
+        return false;
+
+    int64_t size = 0, mtime = 0;
+    if (!statInput(size, mtime))
+        return false;
+
+    std::string tmp_path = path_ + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        out.write(kIndexMagic, sizeof(kIndexMagic));
+        writeValue(out, kIndexVersion);
+        writeValue(out, size);
+        writeValue(out, mtime);
+        writeValue(out, uint32_t(entries_.size()));
+        for (const auto& [stream_index, items] : entries_) {
+            writeValue(out, int32_t(stream_index));
+            writeValue(out, uint32_t(items.size()));
+            out.write(reinterpret_cast<const char*>(items.data()), items.size() * sizeof(FFAVIndexEntry));
+        }
+        if (!out.flush()) {
+            std::remove(tmp_path.c_str());
+            return false;
+        }
+    }
+
+    if (std::rename(tmp_path.c_str(), path_.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+extern "C" {
+#define __STDC_CONSTANT_MACROS
+#include <libavformat/avformat.h>
+}
+
+struct FFAVIndexEntry {
+    int64_t pts;
+    int64_t dts;
+    int64_t pos;
+};
+
+// Keyframe index of one input, kept per stream in stream time_base and
+// persisted next to local files as "<uri>.ffidx". The sidecar is only
+// trusted while the input's size and mtime still match.
+class FFAVKeyIndex {
+public:
+    static std::shared_ptr<FFAVKeyIndex> Create(const std::string& uri);
+    std::string GetPath() const;
+    bool IsComplete() const;
+    void SetComplete(bool complete);
+    size_t GetEntryCount(int stream_index) const;
+    std::vector<FFAVIndexEntry> GetEntries(int stream_index) const;
+    // Streams where every packet is a keyframe, audio and intra-only video,
+    // are thinned to one entry per second, other streams keep every keyframe.
+    static bool IsIntraOnly(const AVCodecParameters& params);
+    void AddEntry(int stream_index, AVRational time_base, bool intra_only, const FFAVIndexEntry& entry);
+    bool Lookup(int stream_index, int64_t timestamp, FFAVIndexEntry& entry) const;
+    bool Load();
+    bool Save() const;
+
+private:
+    FFAVKeyIndex() = default;
+    bool initialize(const std::string& uri);
+    bool statInput(int64_t& size, int64_t& mtime) const;
+
+private:
+    mutable std::mutex mutex_;
+    std::atomic_bool complete_{false};
+    std::string uri_;
+    std::string path_;
+    std::map<int, std::vector<FFAVIndexEntry>> entries_;
+};
@@ -0,0 +1,678 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include "avio.h"
+
+std::string AVIOPath(const std::string& uri) {
+    if (uri.rfind("file:", 0) == 0)
+        return uri.substr(5);
+    return uri;
+}
+
+bool FFAVIO::initialize(int buffer_size, bool writable, bool seekable) {
+    auto buffer = static_cast<unsigned char*>(av_malloc(buffer_size));
+    if (!buffer)
+        return false;
+
+    AVIOContext *context = avio_alloc_context(
+        buffer, buffer_size, writable ? 1 : 0, this,
+        writable ? nullptr : &FFAVIO::readPacket,
+        writable ? &FFAVIO::writePacket : nullptr,
+        seekable ? &FFAVIO::seekPacket : nullptr);
+    if (!context) {
+        av_free(buffer);
+        return false;
+    }
+
+    context_ = std::shared_ptr<AVIOContext>(context, [](AVIOContext *p) {
+        av_freep(&p->buffer);
+        avio_context_free(&p);
+    });
+    return true;
+}
+
+std::shared_ptr<AVIOContext> FFAVIO::GetContext() const {
+    return context_;
+}
+
+bool FFAVIO::Close() {
+    return true;
+}
+
+std::shared_ptr<FFAVIO> FFAVIO::Reopen() const {
+    return nullptr;
+}
+
+int FFAVIO::read(uint8_t*, int) {
+    return AVERROR(ENOSYS);
+}
+
+int FFAVIO::write(const uint8_t*, int) {
+    return AVERROR(ENOSYS);
+}
+
+int64_t FFAVIO::seek(int64_t, int) {
+    return AVERROR(ENOSYS);
+}
+
+int FFAVIO::readPacket(void *opaque, uint8_t *buf, int size) {
+    return static_cast<FFAVIO*>(opaque)->read(buf, size);
+}
+
+int FFAVIO::writePacket(void *opaque, const uint8_t *buf, int size) {
+    return static_cast<FFAVIO*>(opaque)->write(buf, size);
+}
+
+int64_t FFAVIO::seekPacket(void *opaque, int64_t offset, int whence) {
+    return static_cast<FFAVIO*>(opaque)->seek(offset, whence);
+}
+
+std::shared_ptr<FFAVMmapIO> FFAVMmapIO::Create(const std::string& uri, size_t readahead) {
+    auto instance = std::shared_ptr<FFAVMmapIO>(new FFAVMmapIO());
+    if (!instance->initialize(uri, readahead))
+        return nullptr;
+    return instance;
+}
+
+FFAVMmapIO::~FFAVMmapIO() {
+    if (data_)
+        munmap(data_, size_);
+}
+
+std::shared_ptr<FFAVIO> FFAVMmapIO::Reopen() const {
+    return Create(uri_, readahead_);
+}
+
+bool FFAVMmapIO::initialize(const std::string& uri, size_t readahead) {
+    uri_ = uri;
+    auto path = AVIOPath(uri);
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        AVLogError("open(", path, "): ", strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        AVLogError("mmap(", path, "): ", strerror(errno));
+        return false;
+    }
+
+    data_ = static_cast<uint8_t*>(data);
+    size_ = st.st_size;
+    readahead_ = std::max<size_t>(readahead, 1 << 20);
+    madvise(data_, size_, MADV_SEQUENTIAL);
+    adviseAhead(0);
+
+    return FFAVIO::initialize(64 << 10, false, true);
+}
+
+void FFAVMmapIO::adviseAhead(int64_t pos) {
+    if (pos + int64_t(readahead_ / 2) < advised_end_ && pos >= advised_end_ - int64_t(readahead_))
+        return;
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    int64_t start = pos & ~int64_t(page_size - 1);
+    int64_t end = std::min(size_, pos + int64_t(readahead_));
+    if (start >= end)
+        return;
+
+    madvise(data_ + start, end - start, MADV_WILLNEED);
+    advised_end_ = end;
+}
+
+int FFAVMmapIO::read(uint8_t *buf, int size) {
+    if (pos_ >= size_)
+        return AVERROR_EOF;
+
+    int len = int(std::min<int64_t>(size, size_ - pos_));
+    memcpy(buf, data_ + pos_, len);
+    pos_ += len;
+    adviseAhead(pos_);
+    return len;
+}
+
+int64_t FFAVMmapIO::seek(int64_t offset, int whence) {
+    int64_t pos = 0;
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+        return size_;
+    case SEEK_SET:
+        pos = offset;
+        break;
+    case SEEK_CUR:
+        pos = pos_ + offset;
+        break;
+    case SEEK_END:
+        pos = size_ + offset;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+
+    if (pos < 0 || pos > size_)
+        return AVERROR(EINVAL);
+
+    pos_ = pos;
+    adviseAhead(pos_);
+    return pos_;
+}
+
+std::shared_ptr<FFAVMemoryIO> FFAVMemoryIO::Create(const uint8_t *data, size_t size) {
+    auto instance = std::shared_ptr<FFAVMemoryIO>(new FFAVMemoryIO());
+    if (!instance->initialize(data, size))
+        return nullptr;
+    return instance;
+}
+
+std::shared_ptr<FFAVIO> FFAVMemoryIO::Reopen() const {
+    return Create(data_, size_t(size_));
+}
+
+bool FFAVMemoryIO::initialize(const uint8_t *data, size_t size) {
+    if (!data || size == 0)
+        return false;
+
+    data_ = data;
+    size_ = int64_t(size);
+    return FFAVIO::initialize(64 << 10, false, true);
+}
+
+int FFAVMemoryIO::read(uint8_t *buf, int size) {
+    if (pos_ >= size_)
+        return AVERROR_EOF;
+
+    int len = int(std::min<int64_t>(size, size_ - pos_));
+    memcpy(buf, data_ + pos_, len);
+    pos_ += len;
+    return len;
+}
+
+int64_t FFAVMemoryIO::seek(int64_t offset, int whence) {
+    int64_t pos = 0;
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+        return size_;
+    case SEEK_SET:
+        pos = offset;
+        break;
+    case SEEK_CUR:
+        pos = pos_ + offset;
+        break;
+    case SEEK_END:
+        pos = size_ + offset;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+
+    if (pos < 0 || pos > size_)
+        return AVERROR(EINVAL);
+
+    pos_ = pos;
+    return pos_;
+}
+
+std::shared_ptr<FFAVCallbackIO> FFAVCallbackIO::Create(void *opaque, ReadCallback read, SeekCallback seek) {
+    auto instance = std::shared_ptr<FFAVCallbackIO>(new FFAVCallbackIO());
+    if (!instance->initialize(opaque, read, seek))
+        return nullptr;
+    return instance;
+}
+
+bool FFAVCallbackIO::initialize(void *opaque, ReadCallback read, SeekCallback seek) {
+    if (!read)
+        return false;
+
+    opaque_ = opaque;
+    read_ = read;
+    seek_ = seek;
+    return FFAVIO::initialize(64 << 10, false, seek != nullptr);
+}
+
+int FFAVCallbackIO::read(uint8_t *buf, int size) {
+    int ret = read_(opaque_, buf, size);
+    if (ret == 0)
+        return AVERROR_EOF;
+    return ret;
+}
+
+int64_t FFAVCallbackIO::seek(int64_t offset, int whence) {
+    return seek_(opaque_, offset, whence);
+}
+
+std::shared_ptr<FFAVUringIO> FFAVUringIO::Create(const std::string& uri, const FFAVReadAheadOption& option) {
+    auto instance = std::shared_ptr<FFAVUringIO>(new FFAVUringIO());
+    if (!instance->initialize(uri, option))
+        return nullptr;
+    return instance;
+}
+
+FFAVUringIO::~FFAVUringIO() {
+    drain();
+#ifdef HAVE_LIBURING
+    if (async_)
+        io_uring_queue_exit(&ring_);
+#endif
+    for (auto& block : blocks_)
+        free(block.data);
+    if (fd_ >= 0)
+        close(fd_);
+}
+
+std::shared_ptr<FFAVIO> FFAVUringIO::Reopen() const {
+    return Create(uri_, option_);
+}
+
+bool FFAVUringIO::initialize(const std::string& uri, const FFAVReadAheadOption& option) {
+    uri_ = uri;
+    option_ = option;
+    auto path = AVIOPath(uri);
+    fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+        AVLogError("open(", path, "): ", strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd_, &st) != 0)
+        return false;
+    size_ = st.st_size;
+
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    block_size_ = std::max(option.block_size, page_size);
+    block_size_ = (block_size_ + page_size - 1) / page_size * page_size;
+    size_t depth = std::max<size_t>(1, std::min<size_t>(
+        std::max(option.depth, 1), option.max_bytes / block_size_));
+
+    blocks_.resize(depth);
+    for (auto& block : blocks_) {
+        void *data = nullptr;
+        if (posix_memalign(&data, page_size, block_size_) != 0)
+            return false;
+        block = { 0, 0, false, false, static_cast<uint8_t*>(data) };
+    }
+
+#ifdef HAVE_LIBURING
+    int ret = io_uring_queue_init(depth, &ring_, 0);
+    if (ret == 0)
+        async_ = true;
+    else
+        AVLogWarning("io_uring_queue_init: ", strerror(-ret), ", fallback to pread");
+#endif
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    if (!restart(0))
+        return false;
+    return FFAVIO::initialize(64 << 10, false, true);
+}
+
+bool FFAVUringIO::IsAsync() const {
+#ifdef HAVE_LIBURING
+    return async_;
+#else
+    return false;
+#endif
+}
+
+bool FFAVUringIO::schedule(size_t index) {
+    auto& block = blocks_[index];
+    block.offset = next_offset_;
+    block.result = 0;
+    block.pending = false;
+    if (next_offset_ >= size_)
+        return true;
+    next_offset_ += block_size_;
+
+    // A block that never reaches the ring is read with pread in waitBlock.
+    block.pending = true;
+    block.queued = false;
+#ifdef HAVE_LIBURING
+    if (async_) {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&ring_);
+        if (!sqe)
+            return true;
+        io_uring_prep_read(sqe, fd_, block.data, block_size_, block.offset);
+        io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(uintptr_t(index)));
+        int ret = io_uring_submit(&ring_);
+        if (ret >= 0) {
+            block.queued = true;
+            return true;
+        }
+
+        // The unsubmitted entry stays in the ring, so retire the ring once
+        // the reads in flight complete rather than submit it later.
+        AVLogWarning("io_uring_submit: ", strerror(-ret), ", fallback to pread");
+        for (size_t i = 0; i < blocks_.size(); i++) {
+            if (blocks_[i].queued)
+                waitBlock(i);
+        }
+        io_uring_queue_exit(&ring_);
+        async_ = false;
+        for (auto& item : blocks_)
+            item.queued = false;
+    }
+#endif
+    return true;
+}
+
+bool FFAVUringIO::waitBlock(size_t index) {
+    auto& block = blocks_[index];
+#ifdef HAVE_LIBURING
+    while (block.queued) {
+        struct io_uring_cqe *cqe = nullptr;
+        int ret = io_uring_wait_cqe(&ring_, &cqe);
+        if (ret == -EINTR)
+            continue;
+        if (ret < 0)
+            return false;
+
+        auto& done = blocks_[uintptr_t(io_uring_cqe_get_data(cqe))];
+        done.result = cqe->res < 0 ? AVERROR(-cqe->res) : cqe->res;
+        done.pending = false;
+        done.queued = false;
+        io_uring_cqe_seen(&ring_, cqe);
+    }
+#endif
+    if (block.pending) {
+        block.result = 0;
+        block.pending = false;
+    }
+
+    // Reads may return short before the block end, read the rest in place
+    // until the block is full or the file ends.
+    int64_t want = std::min<int64_t>(block_size_, size_ - block.offset);
+    while (block.result >= 0 && block.result < want) {
+        ssize_t ret = pread(fd_, block.data + block.result, want - block.result, block.offset + block.result);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0) {
+            block.result = AVERROR(errno);
+            break;
+        }
+        if (ret == 0)
+            break;
+        block.result += int(ret);
+    }
+    return true;
+}
+
+void FFAVUringIO::drain() {
+    for (size_t i = 0; i < blocks_.size(); i++) {
+#ifdef HAVE_LIBURING
+        if (blocks_[i].queued)
+            waitBlock(i);
+#endif
+        blocks_[i].pending = false;
+    }
+}
+
+bool FFAVUringIO::restart(int64_t pos) {
+    drain();
+    head_ = 0;
+    next_offset_ = pos / block_size_ * block_size_;
+    for (size_t i = 0; i < blocks_.size(); i++) {
+        if (!schedule(i))
+            return false;
+    }
+    return true;
+}
+
+int FFAVUringIO::read(uint8_t *buf, int size) {
+    if (pos_ >= size_)
+        return AVERROR_EOF;
+
+    // Skipping forward inside the window recycles the passed blocks.
+    while (pos_ >= blocks_[head_].offset + int64_t(block_size_) && pos_ < next_offset_) {
+        if (!waitBlock(head_) || !schedule(head_))
+            return AVERROR(EIO);
+        head_ = (head_ + 1) % blocks_.size();
+    }
+
+    auto& block = blocks_[head_];
+    if (pos_ < block.offset || pos_ >= block.offset + int64_t(block_size_)) {
+        if (!restart(pos_))
+            return AVERROR(EIO);
+    }
+
+    auto& current = blocks_[head_];
+    if (!waitBlock(head_))
+        return AVERROR(EIO);
+    if (current.result < 0)
+        return current.result;
+
+    // waitBlock fills short reads, less data only means the file shrank.
+    int64_t skip = pos_ - current.offset;
+    if (current.result <= skip)
+        return AVERROR_EOF;
+
+    int len = int(std::min<int64_t>(size, current.result - skip));
+    memcpy(buf, current.data + skip, len);
+    pos_ += len;
+
+    if (pos_ >= current.offset + int64_t(block_size_)) {
+        if (!schedule(head_))
+            return AVERROR(EIO);
+        head_ = (head_ + 1) % blocks_.size();
+    }
+    return len;
+}
+
+int64_t FFAVUringIO::seek(int64_t offset, int whence) {
+    int64_t pos = 0;
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+        return size_;
+    case SEEK_SET:
+        pos = offset;
+        break;
+    case SEEK_CUR:
+        pos = pos_ + offset;
+        break;
+    case SEEK_END:
+        pos = size_ + offset;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+
+    if (pos < 0 || pos > size_)
+        return AVERROR(EINVAL);
+
+    pos_ = pos;
+    return pos_;
+}
+
+std::shared_ptr<FFAVWriteIO> FFAVWriteIO::Create(const std::string& uri, const FFAVWriteBehindOption& option) {
+    auto instance = std::shared_ptr<FFAVWriteIO>(new FFAVWriteIO());
+    if (!instance->initialize(uri, option))
+        return nullptr;
+    return instance;
+}
+
+FFAVWriteIO::~FFAVWriteIO() {
+    Close();
+    for (auto data : free_)
+        free(data);
+}
+
+bool FFAVWriteIO::initialize(const std::string& uri, const FFAVWriteBehindOption& option) {
+    auto path = AVIOPath(uri);
+    fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        AVLogError("open(", path, "): ", strerror(errno));
+        return false;
+    }
+
+#ifdef __linux__
+    if (option.preallocate > 0) {
+        if (fallocate(fd_, FALLOC_FL_KEEP_SIZE, 0, option.preallocate) != 0)
+            AVLogError("fallocate(", path, "): ", strerror(errno));
+    }
+#endif
+
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    chunk_size_ = std::max(option.chunk_size, page_size);
+    chunk_size_ = (chunk_size_ + page_size - 1) / page_size * page_size;
+    max_chunks_ = std::max<size_t>(2, option.max_memory / chunk_size_);
+
+    if (!FFAVIO::initialize(64 << 10, true, true))
+        return false;
+
+    writer_ = std::thread(&FFAVWriteIO::runWriter, this);
+    return true;
+}
+
+bool FFAVWriteIO::acquireChunk(int64_t offset) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [&] {
+        return error_.load() != 0 || !free_.empty() || allocated_ < max_chunks_;
+    });
+    if (error_.load() != 0)
+        return false;
+
+    uint8_t *data = nullptr;
+    if (!free_.empty()) {
+        data = free_.back();
+        free_.pop_back();
+    } else {
+        void *p = nullptr;
+        if (posix_memalign(&p, sysconf(_SC_PAGESIZE), chunk_size_) != 0)
+            return false;
+        data = static_cast<uint8_t*>(p);
+        allocated_++;
+    }
+
+    current_ = { offset, 0, data };
+    return true;
+}
+
+void FFAVWriteIO::submitChunk() {
+    if (!current_.data)
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (current_.size > 0)
+        queue_.push_back(current_);
+    else
+        free_.push_back(current_.data);
+    current_ = { 0, 0, nullptr };
+    cond_.notify_all();
+}
+
+int FFAVWriteIO::write(const uint8_t *buf, int size) {
+    int written = 0;
+    while (written < size) {
+        if (error_.load() != 0)
+            return error_.load();
+
+        if (current_.data && current_.offset + int64_t(current_.size) != pos_)
+            submitChunk();
+        if (!current_.data && !acquireChunk(pos_))
+            return error_.load() != 0 ? error_.load() : AVERROR(ENOMEM);
+
+        size_t len = std::min(size_t(size - written), chunk_size_ - current_.size);
+        memcpy(current_.data + current_.size, buf + written, len);
+        current_.size += len;
+        written += int(len);
+        pos_ += len;
+        size_ = std::max(size_, pos_);
+
+        if (current_.size == chunk_size_)
+            submitChunk();
+    }
+    return written;
+}
+
+int64_t FFAVWriteIO::seek(int64_t offset, int whence) {
+    int64_t pos = 0;
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+        return size_;
+    case SEEK_SET:
+        pos = offset;
+        break;
+    case SEEK_CUR:
+        pos = pos_ + offset;
+        break;
+    case SEEK_END:
+        pos = size_ + offset;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+
+    if (pos < 0)
+        return AVERROR(EINVAL);
+
+    pos_ = pos;
+    return pos_;
+}
+
+void FFAVWriteIO::runWriter() {
+    while (true) {
+        Chunk chunk;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [&] {
+                return stopped_ || !queue_.empty();
+            });
+            if (queue_.empty())
+                return;
+            chunk = queue_.front();
+            queue_.pop_front();
+        }
+
+        size_t done = 0;
+        while (done < chunk.size && error_.load() == 0) {
+            ssize_t ret = pwrite(fd_, chunk.data + done, chunk.size - done, chunk.offset + done);
+            if (ret < 0) {
+                if (errno == EINTR)
+                    continue;
+                AVLogError("pwrite: ", strerror(errno));
+                error_.store(AVERROR(errno));
+                break;
+            }
+            done += ret;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(chunk.data);
+        cond_.notify_all();
+    }
+}
+
+bool FFAVWriteIO::Close() {
+    if (closed_.exchange(true))
+        return error_.load() == 0;
+
+    if (context_)
+        avio_flush(context_.get());
+    submitChunk();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+        cond_.notify_all();
+    }
+    if (writer_.joinable())
+        writer_.join();
+
+    if (fd_ >= 0) {
+        if (close(fd_) != 0 && error_.load() == 0)
+            error_.store(AVERROR(errno));
+        fd_ = -1;
+    }
+    return error_.load() == 0;
+}
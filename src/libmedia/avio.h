@@ -0,0 +1,210 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "avutil.h"
+extern "C" {
+#define __STDC_CONSTANT_MACROS
+#include <libavformat/avio.h>
+#include <libavutil/mem.h>
+}
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+// Base of the custom AVIOContext backends, subclasses override the
+// callbacks they support and the context forwards to them.
+class FFAVIO {
+public:
+    virtual ~FFAVIO() = default;
+    std::shared_ptr<AVIOContext> GetContext() const;
+    virtual bool Close();
+    // A fresh reader of the same input at position 0, null when the
+    // backend can't open a second one.
+    virtual std::shared_ptr<FFAVIO> Reopen() const;
+
+protected:
+    FFAVIO() = default;
+    bool initialize(int buffer_size, bool writable, bool seekable);
+    virtual int read(uint8_t *buf, int size);
+    virtual int write(const uint8_t *buf, int size);
+    virtual int64_t seek(int64_t offset, int whence);
+
+private:
+    static int readPacket(void *opaque, uint8_t *buf, int size);
+    static int writePacket(void *opaque, const uint8_t *buf, int size);
+    static int64_t seekPacket(void *opaque, int64_t offset, int whence);
+
+protected:
+    std::shared_ptr<AVIOContext> context_;
+};
+
+class FFAVMmapIO final : public FFAVIO {
+public:
+    static std::shared_ptr<FFAVMmapIO> Create(const std::string& uri, size_t readahead = 8 << 20);
+    ~FFAVMmapIO();
+    std::shared_ptr<FFAVIO> Reopen() const override;
+
+private:
+    FFAVMmapIO() = default;
+    bool initialize(const std::string& uri, size_t readahead);
+    int read(uint8_t *buf, int size) override;
+    int64_t seek(int64_t offset, int whence) override;
+    void adviseAhead(int64_t pos);
+
+private:
+    std::string uri_;
+    uint8_t *data_{nullptr};
+    int64_t size_{0};
+    int64_t pos_{0};
+    int64_t advised_end_{0};
+    size_t readahead_{0};
+};
+
+// Reads from caller-owned memory, which must outlive the IO.
+class FFAVMemoryIO final : public FFAVIO {
+public:
+    static std::shared_ptr<FFAVMemoryIO> Create(const uint8_t *data, size_t size);
+    std::shared_ptr<FFAVIO> Reopen() const override;
+
+private:
+    FFAVMemoryIO() = default;
+    bool initialize(const uint8_t *data, size_t size);
+    int read(uint8_t *buf, int size) override;
+    int64_t seek(int64_t offset, int whence) override;
+
+private:
+    const uint8_t *data_{nullptr};
+    int64_t size_{0};
+    int64_t pos_{0};
+};
+
+// Forwards to caller callbacks, a null seek makes the input non-seekable.
+class FFAVCallbackIO final : public FFAVIO {
+public:
+    using ReadCallback = int (*)(void *opaque, uint8_t *buf, int size);
+    using SeekCallback = int64_t (*)(void *opaque, int64_t offset, int whence);
+    static std::shared_ptr<FFAVCallbackIO> Create(void *opaque, ReadCallback read, SeekCallback seek);
+
+private:
+    FFAVCallbackIO() = default;
+    bool initialize(void *opaque, ReadCallback read, SeekCallback seek);
+    int read(uint8_t *buf, int size) override;
+    int64_t seek(int64_t offset, int whence) override;
+
+private:
+    void *opaque_{nullptr};
+    ReadCallback read_{nullptr};
+    SeekCallback seek_{nullptr};
+};
+
+// depth: reads kept in flight ahead of the position, capped by
+// max_bytes / block_size. block_size is rounded up to a page multiple.
+struct FFAVReadAheadOption {
+    int depth{8};
+    size_t block_size{1 << 20};
+    size_t max_bytes{16 << 20};
+};
+
+// Sequential reader that keeps aligned block reads in flight through
+// io_uring, or reads each block with pread when io_uring is unavailable.
+class FFAVUringIO final : public FFAVIO {
+    struct Block {
+        int64_t offset;
+        int result;
+        bool pending;
+        bool queued;
+        uint8_t *data;
+    };
+
+public:
+    static std::shared_ptr<FFAVUringIO> Create(const std::string& uri, const FFAVReadAheadOption& option = {});
+    ~FFAVUringIO();
+    std::shared_ptr<FFAVIO> Reopen() const override;
+    bool IsAsync() const;
+
+private:
+    FFAVUringIO() = default;
+    bool initialize(const std::string& uri, const FFAVReadAheadOption& option);
+    int read(uint8_t *buf, int size) override;
+    int64_t seek(int64_t offset, int whence) override;
+    bool restart(int64_t pos);
+    bool schedule(size_t index);
+    bool waitBlock(size_t index);
+    void drain();
+
+private:
+    std::string uri_;
+    FFAVReadAheadOption option_;
+    int fd_{-1};
+    int64_t size_{0};
+    int64_t pos_{0};
+    int64_t next_offset_{0};
+    size_t block_size_{0};
+    size_t head_{0};
+    std::vector<Block> blocks_;
+#ifdef HAVE_LIBURING
+    bool async_{false};
+    struct io_uring ring_;
+#endif
+};
+
+// chunk_size: size of each write, rounded up to a page multiple.
+// max_memory: bytes of chunks queued or being written before the muxer
+// waits. preallocate: bytes reserved with fallocate up front, 0 for none.
+struct FFAVWriteBehindOption {
+    size_t chunk_size{4 << 20};
+    size_t max_memory{64 << 20};
+    int64_t preallocate{0};
+};
+
+// Output that copies muxer writes into chunks and leaves the pwrite calls
+// to a background thread. Seeks start a new chunk, chunks are written in
+// order so later rewrites of the same range win.
+class FFAVWriteIO final : public FFAVIO {
+    struct Chunk {
+        int64_t offset;
+        size_t size;
+        uint8_t *data;
+    };
+
+public:
+    static std::shared_ptr<FFAVWriteIO> Create(const std::string& uri, const FFAVWriteBehindOption& option = {});
+    ~FFAVWriteIO();
+    bool Close() override;
+
+private:
+    FFAVWriteIO() = default;
+    bool initialize(const std::string& uri, const FFAVWriteBehindOption& option);
+    int write(const uint8_t *buf, int size) override;
+    int64_t seek(int64_t offset, int whence) override;
+    bool acquireChunk(int64_t offset);
+    void submitChunk();
+    void runWriter();
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::atomic_int error_{0};
+    std::atomic_bool closed_{false};
+    bool stopped_{false};
+    int fd_{-1};
+    int64_t pos_{0};
+    int64_t size_{0};
+    size_t chunk_size_{0};
+    size_t max_chunks_{0};
+    size_t allocated_{0};
+    Chunk current_{0, 0, nullptr};
+    std::deque<Chunk> queue_;
+    std::vector<uint8_t*> free_;
+    std::thread writer_;
+};
+
+std::string AVIOPath(const std::string& uri);
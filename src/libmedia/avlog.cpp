@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include "avlog.h"
+
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+FFAVLog& FFAVLog::GetInstance() {
+    static FFAVLog *instance = [] {
+        auto log = new FFAVLog();
+        std::atexit([] {
+            GetInstance().Flush();
+        });
+        return log;
+    }();
+    return *instance;
+}
+
+FFAVLog::FFAVLog() {
+    std::thread(&FFAVLog::runFlusher, this).detach();
+}
+
+void FFAVLog::SetLevel(FFAVLogLevel level) {
+    level_.store(level, std::memory_order_relaxed);
+}
+
+FFAVLogLevel FFAVLog::GetLevel() const {
+    return level_.load(std::memory_order_relaxed);
+}
+
+bool FFAVLog::IsEnabled(FFAVLogLevel level) const {
+    return level != FFAVLogLevel::Quiet && level >= level_.load(std::memory_order_relaxed);
+}
+
+FFAVLog::Ring& FFAVLog::threadRing() {
+    thread_local std::shared_ptr<Ring> ring;
+    if (!ring) {
+        ring = std::make_shared<Ring>(kRingSize);
+        std::lock_guard<std::mutex> lock(mutex_);
+        rings_.push_back(ring);
+    }
+    return *ring;
+}
+
+void FFAVLog::Write(FFAVLogLevel level, Formatter formatter) {
+    auto& ring = threadRing();
+    Entry entry{ nowNs(), level, std::move(formatter) };
+    if (!ring.Push(std::move(entry))) {
+        // Warnings and errors are never dropped, a full ring writes them
+        // right away, ahead of the entries still queued.
+        if (level >= FFAVLogLevel::Warning) {
+            std::ostringstream err;
+            entry.formatter(err);
+            err << '\n';
+            auto errstr = err.str();
+            fwrite(errstr.data(), 1, errstr.size(), stderr);
+            fflush(stderr);
+            return;
+        }
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // Warnings, errors and bursts are written without waiting for the next
+    // flush period.
+    pushed_.fetch_add(1, std::memory_order_release);
+    if (level >= FFAVLogLevel::Warning || ring.Size() == ring.Capacity() / 2)
+        cond_.notify_one();
+}
+
+void FFAVLog::Flush() {
+    uint64_t target = pushed_.load(std::memory_order_acquire);
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.notify_one();
+    flushed_.wait(lock, [&] {
+        return written_.load() >= target;
+    });
+}
+
+uint64_t FFAVLog::GetDropped() const {
+    return dropped_.load(std::memory_order_relaxed);
+}
+
+size_t FFAVLog::drainRings(std::vector<Entry>& entries) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& ring : rings_) {
+        Entry entry;
+        while (ring->Pop(entry))
+            entries.push_back(std::move(entry));
+    }
+
+    // Rings of exited threads are only referenced here once drained.
+    rings_.erase(std::remove_if(rings_.begin(), rings_.end(), [](const auto& ring) {
+        return ring.use_count() == 1 && ring->Empty();
+    }), rings_.end());
+    return entries.size();
+}
+
+void FFAVLog::writeEntries(std::vector<Entry>& entries) {
+    std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.time < b.time;
+    });
+
+    std::ostringstream out, err;
+    for (const auto& entry : entries) {
+        auto& stream = entry.level >= FFAVLogLevel::Warning ? err : out;
+        entry.formatter(stream);
+        stream << '\n';
+    }
+
+    uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+    uint64_t reported = reported_.exchange(dropped);
+    if (dropped > reported)
+        err << "FFAVLog: dropped " << dropped - reported << " entries\n";
+
+    auto outstr = out.str();
+    auto errstr = err.str();
+    if (!outstr.empty()) {
+        fwrite(outstr.data(), 1, outstr.size(), stdout);
+        fflush(stdout);
+    }
+    if (!errstr.empty()) {
+        fwrite(errstr.data(), 1, errstr.size(), stderr);
+        fflush(stderr);
+    }
+}
+
+void FFAVLog::runFlusher() {
+    std::vector<Entry> entries;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait_for(lock, std::chrono::milliseconds(50));
+        }
+
+        entries.clear();
+        size_t count = drainRings(entries);
+        if (count > 0)
+            writeEntries(entries);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        written_.fetch_add(count);
+        flushed_.notify_all();
+    }
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#include "avqueue.h"
+
+enum class FFAVLogLevel {
+    Debug,
+    Info,
+    Warning,
+    Error,
+    Quiet,
+};
+
+// Each thread logs into its own lock-free ring and a background thread
+// formats, orders and writes the entries, Warning and Error to stderr and
+// the rest to stdout. A full ring drops Debug and Info entries and counts
+// them, Warning and Error are then written synchronously.
+class FFAVLog {
+public:
+    using Formatter = std::function<void(std::ostream&)>;
+
+    // Never destroyed so objects torn down during static destruction can
+    // still log, pending entries are flushed at exit.
+    static FFAVLog& GetInstance();
+    void SetLevel(FFAVLogLevel level);
+    FFAVLogLevel GetLevel() const;
+    bool IsEnabled(FFAVLogLevel level) const;
+    void Write(FFAVLogLevel level, Formatter formatter);
+    // Waits until everything logged before the call is written.
+    void Flush();
+    uint64_t GetDropped() const;
+
+private:
+    struct Entry {
+        int64_t time;
+        FFAVLogLevel level;
+        Formatter formatter;
+    };
+    using Ring = FFAVRingQueue<Entry>;
+
+    FFAVLog();
+    Ring& threadRing();
+    void runFlusher();
+    size_t drainRings(std::vector<Entry>& entries);
+    void writeEntries(std::vector<Entry>& entries);
+
+private:
+    static constexpr size_t kRingSize = 1024;
+    std::atomic<FFAVLogLevel> level_{FFAVLogLevel::Debug};
+    std::atomic_uint64_t dropped_{0};
+    std::atomic_uint64_t reported_{0};
+    std::atomic_uint64_t written_{0};
+    std::atomic_uint64_t pushed_{0};
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::condition_variable flushed_;
+    std::vector<std::shared_ptr<Ring>> rings_;
+};
+
+// Arguments are copied and streamed on the flusher thread, C strings are
+// copied into std::string since their storage may not outlive the call.
+template <typename T>
+auto AVLogCapture(T&& value) {
+    using Value = std::decay_t<T>;
+    if constexpr (std::is_array_v<std::remove_reference_t<T>>)
+        return std::string(value);
+    else if constexpr (std::is_same_v<Value, char*> || std::is_same_v<Value, const char*>)
+        return std::string(value ? value : "(null)");
+    else
+        return Value(std::forward<T>(value));
+}
+
+template <typename... Args>
+void AVLog(FFAVLogLevel level, Args&&... args) {
+    auto& log = FFAVLog::GetInstance();
+    if (!log.IsEnabled(level))
+        return;
+
+    log.Write(level, [captured = std::make_tuple(AVLogCapture(std::forward<Args>(args))...)](std::ostream& out) {
+        std::apply([&out](const auto&... items) {
+            (out << ... << items);
+        }, captured);
+    });
+}
+
+template <typename... Args>
+void AVLogDebug(Args&&... args) {
+    AVLog(FFAVLogLevel::Debug, std::forward<Args>(args)...);
+}
+
+template <typename... Args>
+void AVLogInfo(Args&&... args) {
+    AVLog(FFAVLogLevel::Info, std::forward<Args>(args)...);
+}
+
+template <typename... Args>
+void AVLogWarning(Args&&... args) {
+    AVLog(FFAVLogLevel::Warning, std::forward<Args>(args)...);
+}
+
+template <typename... Args>
+void AVLogError(Args&&... args) {
+    AVLog(FFAVLogLevel::Error, std::forward<Args>(args)...);
+}
@@ -10,17 +10,75 @@ std::pair<uint32_t, std::shared_ptr<FFAVMedia>> MediaManager::CreateMedia() {
     if (!media)
         return { 0, nullptr };
 
-    medias_[++media_id_] = media;
-    return { media_id_, media };
+    uint32_t shard_index = next_shard_.fetch_add(1, std::memory_order_relaxed) % kShards;
+    auto& shard = shards_[shard_index];
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+
+    uint32_t local = 0;
+    if (!shard.frees.empty()) {
+        local = shard.frees.front();
+        shard.frees.pop_front();
+    } else {
+        local = uint32_t(shard.slots.size());
+        if ((local * kShards + shard_index) > kSlotMask) {
+            AVLogError("MediaManager::CreateMedia: out of slots");
+            return { 0, nullptr };
+        }
+        shard.slots.emplace_back();
+    }
+
+    auto& slot = shard.slots[local];
+    slot.media = media;
+    uint32_t media_id = (slot.generation << kSlotBits) | (local * kShards + shard_index);
+    return { media_id, media };
 }
 
 bool MediaManager::DeleteMedia(uint32_t media_id) {
-    if (!medias_.count(media_id))
-        return false;
-    medias_.erase(media_id);
+    uint32_t index = media_id & kSlotMask;
+    uint32_t generation = media_id >> kSlotBits;
+    auto& shard = shards_[index % kShards];
+    uint32_t local = index / kShards;
+
+    // Released outside the lock, closing formats may take a while.
+    std::shared_ptr<FFAVMedia> media;
+    {
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        if (local >= shard.slots.size())
+            return false;
+
+        auto& slot = shard.slots[local];
+        if (slot.generation != generation || !slot.media)
+            return false;
+
+        // Generation 0 is skipped so no id is ever 0.
+        media = std::move(slot.media);
+        slot.generation = (slot.generation + 1) & kGenerationMask;
+        if (slot.generation == 0)
+            slot.generation = 1;
+        shard.frees.push_back(local);
+    }
     return true;
 }
 
 std::shared_ptr<FFAVMedia> MediaManager::GetMedia(uint32_t media_id) const {
-    return medias_.count(media_id) ? medias_.at(media_id) : nullptr;
+    uint32_t index = media_id & kSlotMask;
+    uint32_t generation = media_id >> kSlotBits;
+    const auto& shard = shards_[index % kShards];
+    uint32_t local = index / kShards;
+
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    if (local >= shard.slots.size())
+        return nullptr;
+
+    const auto& slot = shard.slots[local];
+    if (slot.generation != generation)
+        return nullptr;
+    return slot.media;
+}
+
+std::shared_ptr<FFAVScheduler> MediaManager::GetScheduler() {
+    std::call_once(scheduler_once_, [this]() {
+        scheduler_ = FFAVScheduler::Create();
+    });
+    return scheduler_;
 }
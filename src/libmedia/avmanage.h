@@ -1,16 +1,46 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <deque>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
 #include "avmedia.h"
+#include "avschedule.h"
 
+// Media ids pack a slot in the low kSlotBits and the slot's generation above
+// it, so a deleted id does not match the media that later reuses its slot.
+// The generation has 12 bits: a stale id matches again once its slot went
+// through 4095 more deletes. Freed slots are reused oldest first, so with n
+// free slots in a shard that takes at least n * 4095 deletes there.
+// Slots are spread over shards, each with its own reader/writer lock.
 class MediaManager {
+    static constexpr uint32_t kShards = 16;
+    static constexpr uint32_t kSlotBits = 20;
+    static constexpr uint32_t kSlotMask = (1u << kSlotBits) - 1;
+    static constexpr uint32_t kGenerationMask = (1u << (32 - kSlotBits)) - 1;
+
+    struct Slot {
+        uint32_t generation{1};
+        std::shared_ptr<FFAVMedia> media;
+    };
+
+    struct Shard {
+        mutable std::shared_mutex mutex;
+        std::vector<Slot> slots;
+        std::deque<uint32_t> frees;
+    };
+
 public:
     static MediaManager& GetInstance();
     std::pair<uint32_t, std::shared_ptr<FFAVMedia>> CreateMedia();
     bool DeleteMedia(uint32_t media_id);
     std::shared_ptr<FFAVMedia> GetMedia(uint32_t media_id) const;
+    std::shared_ptr<FFAVScheduler> GetScheduler();
 
 private:
     MediaManager() = default;
@@ -18,6 +48,8 @@ private:
     MediaManager& operator=(const MediaManager&) = delete;
 
 private:
-    uint32_t media_id_{0};
-    std::map<uint32_t, std::shared_ptr<FFAVMedia>> medias_;
+    std::atomic_uint32_t next_shard_{0};
+    std::array<Shard, kShards> shards_;
+    std::once_flag scheduler_once_;
+    std::shared_ptr<FFAVScheduler> scheduler_;
 };
@@ -1,5 +1,78 @@
+#include <algorithm>
 #include "avmedia.h"
 
+// Each record is the header, the payload, then side_data_elems side data
+// headers each followed by their bytes.
+struct FFAVSpoolHeader {
+    int64_t pts;
+    int64_t dts;
+    int64_t duration;
+    int32_t flags;
+    int32_t size;
+    int32_t side_data_elems;
+};
+
+struct FFAVSpoolSideData {
+    int32_t type;
+    int64_t size;
+};
+
+static bool writeSpoolPacket(FILE *spool, const AVPacket *packet) {
+    FFAVSpoolHeader header{ packet->pts, packet->dts, packet->duration, packet->flags, packet->size, packet->side_data_elems };
+    if (fwrite(&header, sizeof(header), 1, spool) != 1)
+        return false;
+    if (packet->size > 0 && fwrite(packet->data, packet->size, 1, spool) != 1)
+        return false;
+
+    for (int i = 0; i < packet->side_data_elems; i++) {
+        const auto& item = packet->side_data[i];
+        FFAVSpoolSideData side{ int32_t(item.type), int64_t(item.size) };
+        if (fwrite(&side, sizeof(side), 1, spool) != 1)
+            return false;
+        if (item.size > 0 && fwrite(item.data, item.size, 1, spool) != 1)
+            return false;
+    }
+    return true;
+}
+
+static std::shared_ptr<AVPacket> readSpoolPacket(FILE *spool, bool& eof) {
+    FFAVSpoolHeader header;
+    if (fread(&header, sizeof(header), 1, spool) != 1) {
+        eof = feof(spool);
+        return nullptr;
+    }
+
+    AVPacket *packet = av_packet_alloc();
+    if (!packet)
+        return nullptr;
+
+    auto packet_ptr = std::shared_ptr<AVPacket>(packet, [](AVPacket *p) {
+        av_packet_unref(p);
+        av_packet_free(&p);
+    });
+    if (av_new_packet(packet, header.size) < 0)
+        return nullptr;
+    if (header.size > 0 && fread(packet->data, header.size, 1, spool) != 1)
+        return nullptr;
+
+    for (int i = 0; i < header.side_data_elems; i++) {
+        FFAVSpoolSideData side;
+        if (fread(&side, sizeof(side), 1, spool) != 1)
+            return nullptr;
+        uint8_t *data = av_packet_new_side_data(packet, AVPacketSideDataType(side.type), side.size);
+        if (!data)
+            return nullptr;
+        if (side.size > 0 && fread(data, side.size, 1, spool) != 1)
+            return nullptr;
+    }
+
+    packet->pts = header.pts;
+    packet->dts = header.dts;
+    packet->duration = header.duration;
+    packet->flags = header.flags;
+    return packet_ptr;
+}
+
 std::shared_ptr<FFAVMedia> FFAVMedia::Create() {
     auto instance = std::shared_ptr<FFAVMedia>(new FFAVMedia());
     if (!instance->initialize())
@@ -16,6 +89,7 @@ bool FFAVMedia::seekPacket(std::shared_ptr<FFAVDemuxer> demuxer) {
     if (optseeks_.count(uri))
         return true;
 
+    demuxer->SetAccurateSeek(accurate_seek_.load());
     for (const auto& [stream_index, option] : options_[uri]) {
         if (option.seek_timestamp > 0) {
             if (!demuxer->Seek(stream_index, option.seek_timestamp)) {
@@ -65,13 +139,702 @@ bool FFAVMedia::dropStreams() {
     return true;
 }
 
+bool FFAVMedia::runStages(
+    const std::vector<FFAVStage>& stages,
+    const std::vector<std::function<void()>>& aborts) {
+    {
+        std::lock_guard<std::mutex> lock(abort_mutex_);
+        if (cancelled_.load())
+            return false;
+        aborts_ = aborts;
+    }
+
+    std::atomic_bool failed{false};
+    std::vector<std::thread> threads;
+    uint32_t trace_id = FFAVTracer::GetThreadTrace();
+    for (const auto& stage : stages) {
+        threads.emplace_back([&, stage]() {
+            FFAVTraceScope trace(trace_id);
+            if (stage())
+                return;
+            if (failed.exchange(true))
+                return;
+            for (const auto& abort : aborts)
+                abort();
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    std::lock_guard<std::mutex> lock(abort_mutex_);
+    aborts_.clear();
+    return !failed.load() && !cancelled_.load();
+}
+
+bool FFAVMedia::demuxStage(
+    std::shared_ptr<FFAVDemuxer> demuxer,
+    const std::unordered_map<int, std::shared_ptr<FFAVPacketQueue>>& outputs) {
+    std::unordered_set<int> flushed;
+    while (true) {
+        auto packet = demuxer->ReadPacket();
+        if (!packet) {
+            if (!demuxer->PacketEOF())
+                return false;
+
+            for (const auto& [stream_index, output] : outputs) {
+                if (flushed.count(stream_index))
+                    continue;
+                if (!output->Push(nullptr))
+                    return false;
+            }
+            return true;
+        }
+
+        int stream_index = packet->stream_index;
+        if (!outputs.count(stream_index) || flushed.count(stream_index))
+            continue;
+
+        // The packet crossing the duration limit is dropped by the serial
+        // path as well, so it's replaced with the in-band flush marker.
+        auto stream = demuxer->GetStream(stream_index);
+        if (stream->ReachLimit()) {
+            flushed.insert(stream_index);
+            packet = nullptr;
+        }
+
+        if (!outputs.at(stream_index)->Push(std::move(packet)))
+            return false;
+    }
+}
+
+bool FFAVMedia::decodeStage(
+    std::shared_ptr<FFAVDecodeStream> stream,
+    std::shared_ptr<FFAVPacketQueue> input,
+    std::shared_ptr<FFAVFrameQueue> output) {
+    std::shared_ptr<AVPacket> packet;
+    while (input->Pop(packet)) {
+        bool flushed = !packet;
+        while (!stream->SendPacket(std::move(packet))) {
+            if (!stream->GetDecoder()->InputFull())
+                return false;
+            auto frame = stream->RecvFrame();
+            if (frame && !output->Push(std::move(frame)))
+                return false;
+            if (!frame && stream->GetDecoder()->InputFull())
+                return false;
+        }
+
+        while (auto frame = stream->RecvFrame()) {
+            if (!output->Push(std::move(frame)))
+                return false;
+        }
+
+        if (flushed)
+            return output->Push(nullptr);
+    }
+    return false;
+}
+
+bool FFAVMedia::convertStage(
+    std::shared_ptr<FFAVDecoder> decoder,
+    std::shared_ptr<FFAVFrameQueue> input,
+    std::shared_ptr<FFAVFrameQueue> output) {
+    std::shared_ptr<AVFrame> frame;
+    while (input->Pop(frame)) {
+        if (!frame)
+            return output->Push(nullptr);
+
+        auto newframe = decoder->ScaleFrame(frame);
+        if (!newframe)
+            return false;
+
+        if (!output->Push(std::move(newframe)))
+            return false;
+    }
+    return false;
+}
+
+bool FFAVMedia::encodeStage(
+    std::shared_ptr<FFAVEncodeStream> stream,
+    std::shared_ptr<FFAVFrameQueue> input,
+    std::shared_ptr<FFAVPacketQueue> output,
+    int producers) {
+    std::shared_ptr<AVFrame> frame;
+    while (input->Pop(frame)) {
+        if (!frame && --producers > 0)
+            continue;
+
+        bool flushed = !frame;
+        if (stream->ReachLimit())
+            frame = nullptr;
+
+        while (!stream->SendFrame(std::move(frame))) {
+            if (!stream->GetEncoder()->InputFull())
+                return false;
+            auto packet = stream->RecvPacket();
+            if (packet && !output->Push(std::move(packet)))
+                return false;
+            if (!packet && stream->GetEncoder()->InputFull())
+                return false;
+        }
+
+        while (auto packet = stream->RecvPacket()) {
+            if (!output->Push(std::move(packet)))
+                return false;
+        }
+
+        if (flushed)
+            return output->Push(nullptr);
+    }
+    return false;
+}
+
+// Every stream of a muxer feeds one queue, so no producer waits on another
+// stream. av_interleaved_write_frame orders the packets and bounds what it
+// holds back by max_interleave_delta.
+bool FFAVMedia::muxStage(std::shared_ptr<FFAVMuxer> muxer, std::shared_ptr<FFAVPacketQueue> input, int producers) {
+    std::shared_ptr<AVPacket> packet;
+    while (producers > 0 && input->Pop(packet)) {
+        if (!packet) {
+            producers--;
+            continue;
+        }
+
+        if (!muxer->WritePacket(std::move(packet)))
+            return false;
+    }
+    return producers == 0 && muxer->WritePacket(nullptr);
+}
+
+bool FFAVMedia::readStage(std::shared_ptr<FFAVDemuxer> demuxer, std::shared_ptr<FFAVPacketQueue> output) {
+    while (true) {
+        auto packet = demuxer->ReadPacket();
+        if (!packet) {
+            if (!demuxer->PacketEOF())
+                return false;
+            return output->Push(nullptr);
+        }
+
+        if (!output->Push(std::move(packet)))
+            return false;
+    }
+}
+
+bool FFAVMedia::remuxStage(const std::map<std::string, std::shared_ptr<FFAVPacketQueue>>& inputs) {
+    std::unordered_map<std::string, int> producers;
+    for (const auto& [uri, rules] : rules_) {
+        std::unordered_set<std::string> targets;
+        for (const auto& item : rules)
+            targets.insert(item.second.uri);
+        for (const auto& target : targets)
+            producers[target]++;
+    }
+
+    std::map<std::string, std::shared_ptr<AVPacket>> pendings;
+    std::unordered_set<std::string> finished;
+    while (true) {
+        for (const auto& [uri, input] : inputs) {
+            if (finished.count(uri) || pendings.count(uri))
+                continue;
+
+            std::shared_ptr<AVPacket> packet;
+            if (!input->Pop(packet))
+                return false;
+
+            if (packet) {
+                pendings[uri] = packet;
+                continue;
+            }
+
+            finished.insert(uri);
+            std::unordered_set<std::string> targets;
+            for (const auto& item : rules_.at(uri))
+                targets.insert(item.second.uri);
+            for (const auto& target : targets) {
+                if (--producers[target] > 0)
+                    continue;
+                auto muxer = GetMuxer(target);
+                if (!muxer)
+                    return false;
+                if (!muxer->WritePacket(nullptr))
+                    return false;
+            }
+        }
+
+        if (pendings.empty())
+            return true;
+
+        auto source = pendings.begin();
+        for (auto it = pendings.begin(); it != pendings.end(); ++it) {
+            const auto& a = it->second;
+            const auto& b = source->second;
+            if (av_compare_ts(a->dts, a->time_base, b->dts, b->time_base) < 0)
+                source = it;
+        }
+
+        auto packet = source->second;
+        const auto& target = rules_.at(source->first).at(packet->stream_index);
+        pendings.erase(source);
+
+        auto muxer = GetMuxer(target.uri);
+        if (!muxer)
+            return false;
+
+        if (!setDuration(muxer))
+            return false;
+
+        packet->stream_index = target.stream_index;
+        if (!muxer->WritePacket(std::move(packet)))
+            return false;
+    }
+}
+
+bool FFAVMedia::remuxPipeline() {
+    std::vector<FFAVStage> stages;
+    std::vector<std::function<void()>> aborts;
+    std::map<std::string, std::shared_ptr<FFAVPacketQueue>> inputs;
+    for (const auto& item : rules_) {
+        auto demuxer = GetDemuxer(item.first);
+        if (!demuxer)
+            return false;
+
+        if (!seekPacket(demuxer))
+            return false;
+
+        if (!setDuration(demuxer))
+            return false;
+
+        auto queue = std::make_shared<FFAVPacketQueue>(queue_size_.load());
+        aborts.push_back([queue]() { queue->Abort(); });
+        inputs[item.first] = queue;
+        stages.push_back([this, demuxer, queue]() {
+            return readStage(demuxer, queue);
+        });
+    }
+
+    stages.push_back([this, &inputs]() {
+        return remuxStage(inputs);
+    });
+    return runStages(stages, aborts);
+}
+
+bool FFAVMedia::transcodePipeline() {
+    size_t queue_size = queue_size_.load();
+    std::vector<FFAVStage> stages;
+    std::vector<std::function<void()>> aborts;
+    std::vector<std::shared_ptr<FFAVStream>> deferreds;
+    std::vector<std::shared_ptr<FFAVDecoder>> decoders;
+    std::map<std::pair<std::string, int>, std::shared_ptr<FFAVFrameQueue>> encodeinputs;
+    std::map<std::pair<std::string, int>, int> producers;
+    std::unordered_map<std::string, std::shared_ptr<FFAVPacketQueue>> muxinputs;
+    std::unordered_map<std::string, int> muxstreams;
+
+    auto packetQueue = [&]() {
+        auto queue = std::make_shared<FFAVPacketQueue>(queue_size);
+        aborts.push_back([queue]() { queue->Abort(); });
+        return queue;
+    };
+    auto frameQueue = [&]() {
+        auto queue = std::make_shared<FFAVFrameQueue>(queue_size);
+        aborts.push_back([queue]() { queue->Abort(); });
+        return queue;
+    };
+
+    for (const auto& [uri, rules] : rules_) {
+        for (const auto& [stream_index, target] : rules) {
+            auto muxer = GetMuxer(target.uri);
+            if (!muxer)
+                return false;
+
+            auto encodestream = muxer->GetEncodeStream(target.stream_index);
+            if (!encodestream)
+                return false;
+
+            auto key = std::make_pair(target.uri, target.stream_index);
+            producers[key]++;
+            if (encodeinputs.count(key))
+                continue;
+
+            if (!muxinputs.count(target.uri))
+                muxinputs[target.uri] = packetQueue();
+            auto input = frameQueue();
+            auto output = muxinputs.at(target.uri);
+            encodeinputs[key] = input;
+            muxstreams[target.uri]++;
+            deferreds.push_back(encodestream);
+            stages.push_back([this, encodestream, input, output, &producers, key]() {
+                return encodeStage(encodestream, input, output, producers.at(key));
+            });
+        }
+    }
+
+    for (const auto& [uri, rules] : rules_) {
+        auto demuxer = GetDemuxer(uri);
+        if (!demuxer)
+            return false;
+
+        if (!seekPacket(demuxer))
+            return false;
+
+        if (!setDuration(demuxer))
+            return false;
+
+        std::unordered_map<int, std::shared_ptr<FFAVPacketQueue>> decodeinputs;
+        for (const auto& [stream_index, target] : rules) {
+            auto decodestream = demuxer->GetDecodeStream(stream_index);
+            if (!decodestream)
+                return false;
+
+            auto input = packetQueue();
+            auto output = encodeinputs.at(std::make_pair(target.uri, target.stream_index));
+            auto decoder = decodestream->GetDecoder();
+            if (decoder->GetSWScale()) {
+                auto converted = output;
+                output = frameQueue();
+                decoders.push_back(decoder);
+                stages.push_back([this, decoder, output, converted]() {
+                    return convertStage(decoder, output, converted);
+                });
+            }
+
+            decodeinputs[stream_index] = input;
+            deferreds.push_back(decodestream);
+            stages.push_back([this, decodestream, input, output]() {
+                return decodeStage(decodestream, input, output);
+            });
+        }
+
+        stages.push_back([this, demuxer, decodeinputs]() {
+            return demuxStage(demuxer, decodeinputs);
+        });
+    }
+
+    for (const auto& [uri, input] : muxinputs) {
+        auto muxer = GetMuxer(uri);
+        if (!setDuration(muxer))
+            return false;
+
+        if (!muxer->WriteHeader())
+            return false;
+
+        stages.push_back([this, muxer, input, producers = muxstreams.at(uri)]() {
+            return muxStage(muxer, input, producers);
+        });
+    }
+
+    for (auto& stream : deferreds)
+        stream->SetDeferredFlush(true);
+    for (auto& decoder : decoders)
+        decoder->SetDeferredScale(true);
+
+    bool result = runStages(stages, aborts);
+
+    for (auto& stream : deferreds)
+        stream->SetDeferredFlush(false);
+    for (auto& decoder : decoders)
+        decoder->SetDeferredScale(false);
+    return result;
+}
+
+int FFAVMedia::chunkStream() const {
+    if (chunks_.load() <= 1 || rules_.size() != 1 || !options_.empty())
+        return -1;
+
+    // Each chunk opens its own reader, caller callbacks can't offer one.
+    const auto& [uri, rules] = *rules_.begin();
+    auto demuxer = GetDemuxer(uri);
+    if (!demuxer)
+        return -1;
+
+    if (std::dynamic_pointer_cast<FFAVCallbackIO>(demuxer->GetIO()))
+        return -1;
+
+    for (const auto& item : rules) {
+        auto stream = demuxer->GetStream(item.first);
+        if (stream && stream->GetStream()->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+            return item.first;
+    }
+    return -1;
+}
+
+std::vector<FFAVMedia::FFAVChunkRange> FFAVMedia::chunkRanges(
+    std::shared_ptr<FFAVDemuxer> demuxer, int stream_index) const {
+    std::vector<FFAVIndexEntry> entries;
+    auto index = demuxer->GetKeyIndex();
+    if (index && demuxer->BuildIndex())
+        entries = index->GetEntries(stream_index);
+
+    // Cut at the first keyframe past each even share of the duration.
+    std::vector<int64_t> cuts;
+    int chunks = chunks_.load();
+    if (entries.size() >= 2) {
+        int64_t first = entries.front().pts;
+        int64_t span = entries.back().pts - first;
+        for (int i = 1; i < chunks; i++) {
+            int64_t target = first + span / chunks * i;
+            auto it = std::lower_bound(entries.begin(), entries.end(), target,
+                [](const FFAVIndexEntry& item, int64_t ts) {
+                    return item.pts < ts;
+                });
+            if (it == entries.end() || it->pts <= (cuts.empty() ? first : cuts.back()))
+                continue;
+            cuts.push_back(it->pts);
+        }
+    }
+
+    std::vector<FFAVChunkRange> ranges;
+    int64_t start = INT64_MIN;
+    for (auto cut : cuts) {
+        ranges.push_back({ start, cut });
+        start = cut;
+    }
+    ranges.push_back({ start, INT64_MAX });
+    return ranges;
+}
+
+bool FFAVMedia::chunkStage(
+    const std::string& uri,
+    int stream_index,
+    std::shared_ptr<FFAVEncoder> encoder,
+    FFAVChunkRange range,
+    FFAVChunkSink sink,
+    const std::atomic_bool& aborted) {
+    // Reopen through the same backend as the shared demuxer.
+    std::shared_ptr<FFAVIO> io;
+    auto source = GetDemuxer(uri);
+    if (source && source->GetIO()) {
+        io = source->GetIO()->Reopen();
+        if (!io)
+            return false;
+    }
+
+    auto demuxer = FFAVDemuxer::Create(uri, io);
+    if (!demuxer)
+        return false;
+
+    for (auto index : demuxer->GetStreamIndexes()) {
+        if (index != stream_index)
+            demuxer->DropStream(index);
+    }
+
+    auto stream = demuxer->GetStream(stream_index);
+    if (!stream)
+        return false;
+
+    auto time_base = stream->GetTimeBase();
+    if (range.first != INT64_MIN && !demuxer->Seek(stream_index, range.first * av_q2d(time_base)))
+        return false;
+
+    auto decodestream = demuxer->GetDecodeStream(stream_index);
+    if (!decodestream)
+        return false;
+
+    auto decoder = decodestream->GetDecoder();
+    auto params = decoder->GetParameters();
+    auto codec_ctx = encoder->GetContext();
+    if (params && params->codec_type == AVMEDIA_TYPE_VIDEO) {
+        if (params->width != codec_ctx->width || params->height != codec_ctx->height
+            || params->format != codec_ctx->pix_fmt) {
+            if (!decoder->SetSWScale(codec_ctx->width, codec_ctx->height, codec_ctx->pix_fmt, SWS_BICUBIC))
+                return false;
+        }
+    }
+
+    if (!encoder->Open())
+        return false;
+
+    while (!aborted.load()) {
+        auto [index, frame] = demuxer->ReadFrame();
+        if (!frame) {
+            if (!demuxer->FrameEOF())
+                return false;
+            break;
+        }
+
+        // Leading frames before the cut belong to the previous chunk.
+        int64_t pts = av_rescale_q(frame->pts, frame->time_base, time_base);
+        if (pts < range.first)
+            continue;
+        if (pts >= range.second)
+            break;
+
+        while (!encoder->SendFrame(std::move(frame))) {
+            if (!encoder->InputFull())
+                return false;
+            auto packet = encoder->RecvPacket();
+            if (packet && !sink(std::move(packet)))
+                return false;
+            if (!packet && encoder->InputFull())
+                return false;
+        }
+
+        while (auto packet = encoder->RecvPacket()) {
+            if (!sink(std::move(packet)))
+                return false;
+        }
+    }
+
+    if (aborted.load() || !encoder->SendFrame(nullptr))
+        return false;
+
+    while (true) {
+        auto packet = encoder->RecvPacket();
+        if (!packet)
+            return encoder->PacketEOF();
+        if (!sink(std::move(packet)))
+            return false;
+    }
+}
+
+bool FFAVMedia::spoolStage(
+    const std::vector<std::shared_ptr<FILE>>& spools,
+    const std::vector<std::shared_ptr<FFAVQueue<bool>>>& dones,
+    AVRational time_base,
+    FFAVChunkSink sink) {
+    for (size_t i = 0; i < dones.size(); i++) {
+        bool result = false;
+        if (!dones[i]->Pop(result) || !result)
+            return false;
+
+        auto spool = spools[i].get();
+        if (!spool)
+            continue;
+
+        rewind(spool);
+        while (true) {
+            bool eof = false;
+            auto packet = readSpoolPacket(spool, eof);
+            if (!packet) {
+                if (!eof)
+                    return false;
+                break;
+            }
+
+            packet->time_base = time_base;
+            if (!sink(std::move(packet)))
+                return false;
+        }
+    }
+    return true;
+}
+
+bool FFAVMedia::transcodeChunks(int split_index) {
+    const auto& [uri, rules] = *rules_.begin();
+    auto demuxer = GetDemuxer(uri);
+    if (!demuxer)
+        return false;
+
+    auto ranges = chunkRanges(demuxer, split_index);
+    int cores = std::max(1, int(std::thread::hardware_concurrency()));
+    int threads = std::max(1, cores / int(ranges.size()));
+
+    std::atomic_bool aborted{false};
+    std::vector<FFAVStage> stages;
+    std::vector<std::function<void()>> aborts{ [&aborted]() { aborted.store(true); } };
+    std::unordered_map<std::string, std::shared_ptr<FFAVPacketQueue>> muxinputs;
+    std::unordered_map<std::string, int> muxstreams;
+    std::map<std::pair<int, size_t>, std::shared_ptr<FFAVEncoder>> encoders;
+
+    // Headers come first, they open the muxer encoders with global headers
+    // and the per-chunk clones copy those flags.
+    for (const auto& item : rules) {
+        auto muxer = GetMuxer(item.second.uri);
+        if (!muxer || !muxer->WriteHeader())
+            return false;
+    }
+
+    for (const auto& [stream_index, target] : rules) {
+        auto encodestream = GetMuxer(target.uri)->GetEncodeStream(target.stream_index);
+        if (!encodestream)
+            return false;
+
+        auto encoder = encodestream->GetEncoder();
+        size_t count = stream_index == split_index ? ranges.size() : 1;
+        for (size_t i = 0; i < count; i++) {
+            auto clone = encoder->Clone();
+            if (!clone)
+                return false;
+
+            auto codec_ctx = clone->GetContext();
+            if (count > 1 && (codec_ctx->thread_count == 0 || codec_ctx->thread_count > threads))
+                codec_ctx->thread_count = threads;
+            encoders[{ stream_index, i }] = clone;
+        }
+
+        if (!muxinputs.count(target.uri)) {
+            auto queue = std::make_shared<FFAVPacketQueue>(queue_size_.load());
+            aborts.push_back([queue]() { queue->Abort(); });
+            muxinputs[target.uri] = queue;
+        }
+        auto output = muxinputs.at(target.uri);
+        muxstreams[target.uri]++;
+
+        auto sink = [output, index = target.stream_index](std::shared_ptr<AVPacket> packet) {
+            packet->stream_index = index;
+            return output->Push(std::move(packet));
+        };
+
+        if (count == 1) {
+            auto clone = encoders.at({ stream_index, 0 });
+            auto range = FFAVChunkRange{ INT64_MIN, INT64_MAX };
+            stages.push_back([this, uri, stream_index, clone, range, sink, output, &aborted]() {
+                return chunkStage(uri, stream_index, clone, range, sink, aborted) && output->Push(nullptr);
+            });
+            continue;
+        }
+
+        // The first chunk streams into the muxer, later ones spool to
+        // temporary files until every chunk before them has been muxed.
+        std::vector<std::shared_ptr<FILE>> spools(count);
+        std::vector<std::shared_ptr<FFAVQueue<bool>>> dones(count);
+        for (size_t i = 0; i < count; i++) {
+            auto done = std::make_shared<FFAVQueue<bool>>(1);
+            aborts.push_back([done]() { done->Abort(); });
+            dones[i] = done;
+
+            FFAVChunkSink chunksink = sink;
+            if (i > 0) {
+                FILE *file = std::tmpfile();
+                if (!file)
+                    return false;
+                auto spool = std::shared_ptr<FILE>(file, fclose);
+                spools[i] = spool;
+                chunksink = [spool](std::shared_ptr<AVPacket> packet) {
+                    return writeSpoolPacket(spool.get(), packet.get());
+                };
+            }
+
+            auto clone = encoders.at({ stream_index, i });
+            auto range = ranges[i];
+            stages.push_back([this, uri, stream_index, clone, range, chunksink, done, &aborted]() {
+                bool result = chunkStage(uri, stream_index, clone, range, chunksink, aborted);
+                return done->Push(result) && result;
+            });
+        }
+
+        auto time_base = encoder->GetContext()->time_base;
+        stages.push_back([this, spools, dones, time_base, sink, output]() {
+            return spoolStage(spools, dones, time_base, sink) && output->Push(nullptr);
+        });
+    }
+
+    for (const auto& [target_uri, input] : muxinputs) {
+        auto muxer = GetMuxer(target_uri);
+        stages.push_back([this, muxer, input, producers = muxstreams.at(target_uri)]() {
+            return muxStage(muxer, input, producers);
+        });
+    }
+    return runStages(stages, aborts);
+}
+
 std::shared_ptr<FFAVDemuxer> FFAVMedia::GetDemuxer(const std::string& uri) const {
-    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    std::lock_guard<std::mutex> lock(format_mutex_);
     return demuxers_.count(uri) ? demuxers_.at(uri) : nullptr;
 }
 
 std::shared_ptr<FFAVMuxer> FFAVMedia::GetMuxer(const std::string& uri) const {
-    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    std::lock_guard<std::mutex> lock(format_mutex_);
     return muxers_.count(uri) ? muxers_.at(uri) : nullptr;
 }
 
@@ -79,6 +842,80 @@ void FFAVMedia::SetDebug(bool debug) {
     debug_.store(debug);
 }
 
+void FFAVMedia::SetPipeline(bool pipeline, size_t queue_size) {
+    pipeline_.store(pipeline);
+    queue_size_.store(queue_size);
+}
+
+void FFAVMedia::SetAccurateSeek(bool accurate) {
+    accurate_seek_.store(accurate);
+}
+
+void FFAVMedia::SetChunks(int chunks) {
+    chunks_.store(chunks);
+}
+
+void FFAVMedia::SetTrace(const std::string& path) {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    trace_path_ = path;
+}
+
+void FFAVMedia::Cancel() {
+    cancelled_.store(true);
+    std::lock_guard<std::mutex> lock(abort_mutex_);
+    for (const auto& abort : aborts_)
+        abort();
+}
+
+bool FFAVMedia::IsCancelled() const {
+    return cancelled_.load();
+}
+
+std::vector<FFAVStageStats> FFAVMedia::GetStats() const {
+    FFAVDemuxerMap demuxers;
+    FFAVMuxerMap muxers;
+    {
+        std::lock_guard<std::mutex> lock(format_mutex_);
+        demuxers = demuxers_;
+        muxers = muxers_;
+    }
+
+    std::vector<FFAVStageStats> stats;
+    for (const auto& [uri, demuxer] : demuxers) {
+        for (int stream_index : demuxer->GetStreamIndexes()) {
+            auto stream = demuxer->GetStream(stream_index);
+            stats.push_back({ uri, stream_index, "demux", stream->GetStats() });
+            auto decodestream = std::dynamic_pointer_cast<FFAVDecodeStream>(stream);
+            if (decodestream)
+                addCodecStats(stats, uri, stream_index, "decode", decodestream->GetDecoder());
+        }
+    }
+    for (const auto& [uri, muxer] : muxers) {
+        for (int stream_index : muxer->GetStreamIndexes()) {
+            auto encodestream = muxer->GetEncodeStream(stream_index);
+            if (encodestream)
+                addCodecStats(stats, uri, stream_index, "encode", encodestream->GetEncoder());
+            stats.push_back({ uri, stream_index, "mux", muxer->GetStream(stream_index)->GetStats() });
+        }
+    }
+    return stats;
+}
+
+void FFAVMedia::addCodecStats(
+    std::vector<FFAVStageStats>& stats,
+    const std::string& uri,
+    int stream_index,
+    const std::string& stage,
+    std::shared_ptr<FFAVCodec> codec) const {
+    if (!codec)
+        return;
+
+    stats.push_back({ uri, stream_index, stage, codec->GetStats() });
+    auto swscale = codec->GetSWScale();
+    if (swscale)
+        stats.push_back({ uri, stream_index, "scale", swscale->GetStats() });
+}
+
 void FFAVMedia::DumpStreams(const std::string& uri) const {
     std::lock_guard<std::recursive_mutex> lock(mutex_);
     auto demuxer = GetDemuxer(uri);
@@ -90,29 +927,33 @@ void FFAVMedia::DumpStreams(const std::string& uri) const {
         muxer->DumpStreams();
 }
 
-std::shared_ptr<FFAVDemuxer> FFAVMedia::AddDemuxer(const std::string& uri) {
-    auto demuxer = FFAVDemuxer::Create(uri);
+std::shared_ptr<FFAVDemuxer> FFAVMedia::AddDemuxer(const std::string& uri, std::shared_ptr<FFAVIO> io) {
+    auto demuxer = FFAVDemuxer::Create(uri, io);
     if (!demuxer)
         return nullptr;
 
     demuxer->SetDebug(debug_.load());
     std::lock_guard<std::recursive_mutex> lock(mutex_);
+    std::lock_guard<std::mutex> format_lock(format_mutex_);
     demuxers_[uri] = demuxer;
     return demuxer;
 }
 
-std::shared_ptr<FFAVMuxer> FFAVMedia::AddMuxer(const std::string& uri, const std::string& mux_fmt) {
-    auto muxer = FFAVMuxer::Create(uri, mux_fmt);
+std::shared_ptr<FFAVMuxer> FFAVMedia::AddMuxer(const std::string& uri, const std::string& mux_fmt, std::shared_ptr<FFAVIO> io) {
+    auto muxer = FFAVMuxer::Create(uri, mux_fmt, io);
     if (!muxer)
         return nullptr;
 
     muxer->SetDebug(debug_.load());
     std::lock_guard<std::recursive_mutex> lock(mutex_);
+    std::lock_guard<std::mutex> format_lock(format_mutex_);
     muxers_[uri] = muxer;
     return muxer;
 }
 
 bool FFAVMedia::DeleteFormat(const std::string& uri) {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    std::lock_guard<std::mutex> format_lock(format_mutex_);
     if (demuxers_.count(uri)) {
         demuxers_.erase(uri);
         return true;
@@ -145,11 +986,19 @@ bool FFAVMedia::Remux() {
     if (demuxers_.empty() || muxers_.empty() || rules_.empty())
         return false;
 
+    FFAVTraceSession trace(trace_path_);
+
     if (!dropStreams())
         return false;
 
+    if (pipeline_.load())
+        return remuxPipeline();
+
     std::unordered_set<std::string> endflags;
     while (endflags.size() != rules_.size()) {
+        if (cancelled_.load())
+            return false;
+
         for (const auto& [uri, rules] : rules_) {
             if (endflags.count(uri))
                 continue;
@@ -190,7 +1039,7 @@ bool FFAVMedia::Remux() {
                 return false;
 
             packet->stream_index = target.stream_index;
-            if (!muxer->WritePacket(packet))
+            if (!muxer->WritePacket(std::move(packet)))
                 return false;
         }
     }
@@ -202,11 +1051,23 @@ bool FFAVMedia::Transcode() {
     if (demuxers_.empty() || muxers_.empty() || rules_.empty())
         return false;
 
+    FFAVTraceSession trace(trace_path_);
+
     if (!dropStreams())
         return false;
 
+    int split_index = chunkStream();
+    if (split_index >= 0)
+        return transcodeChunks(split_index);
+
+    if (pipeline_.load())
+        return transcodePipeline();
+
     std::unordered_set<std::string> endflags;
     while (endflags.size() != rules_.size()) {
+        if (cancelled_.load())
+            return false;
+
         for (const auto& [uri, rules] : rules_) {
             auto demuxer = GetDemuxer(uri);
             if (!demuxer)
@@ -8,10 +8,12 @@
 #include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_set>
 #include <vector>
 #include "avutil.h"
 #include "avformat.h"
+#include "avqueue.h"
 
 struct FFAVNode {
     std::string uri;
@@ -28,20 +30,36 @@ class FFAVMedia {
     using FFAVMuxerMap = std::unordered_map<std::string, std::shared_ptr<FFAVMuxer>>;
     using FFAVRuleMap = std::unordered_map<std::string, std::unordered_map<int, FFAVNode>>;
     using FFAVOptionMap = std::unordered_map<std::string, std::unordered_map<int, FFAVOption>>;
+    using FFAVPacketQueue = FFAVQueue<std::shared_ptr<AVPacket>>;
+    using FFAVFrameQueue = FFAVQueue<std::shared_ptr<AVFrame>>;
+    using FFAVStage = std::function<bool()>;
+    using FFAVChunkSink = std::function<bool(std::shared_ptr<AVPacket>)>;
+    using FFAVChunkRange = std::pair<int64_t, int64_t>;
 
 public:
     static std::shared_ptr<FFAVMedia> Create();
     std::shared_ptr<FFAVDemuxer> GetDemuxer(const std::string& uri) const;
     std::shared_ptr<FFAVMuxer> GetMuxer(const std::string& uri) const;
     void SetDebug(bool debug);
+    void SetPipeline(bool pipeline, size_t queue_size);
+    void SetAccurateSeek(bool accurate);
+    void SetChunks(int chunks);
+    // Each Remux/Transcode writes its spans to path as Chrome trace JSON,
+    // an empty path turns tracing off.
+    void SetTrace(const std::string& path);
     void DumpStreams(const std::string& uri) const;
-    std::shared_ptr<FFAVDemuxer> AddDemuxer(const std::string& uri);
-    std::shared_ptr<FFAVMuxer> AddMuxer(const std::string& uri, const std::string& mux_fmt);
+    std::shared_ptr<FFAVDemuxer> AddDemuxer(const std::string& uri, std::shared_ptr<FFAVIO> io = nullptr);
+    std::shared_ptr<FFAVMuxer> AddMuxer(const std::string& uri, const std::string& mux_fmt, std::shared_ptr<FFAVIO> io = nullptr);
     bool DeleteFormat(const std::string& uri);
     bool AddRule(const FFAVNode& src, const FFAVNode& dst);
     bool SetOption(const FFAVOption& opt);
     bool Remux();
     bool Transcode();
+    // Stops a running Remux/Transcode from any thread, later calls fail too.
+    void Cancel();
+    bool IsCancelled() const;
+    // Counters are only collected while FFAVStats::SetEnabled(true).
+    std::vector<FFAVStageStats> GetStats() const;
 
 private:
     FFAVMedia() = default;
@@ -49,14 +67,68 @@ private:
     bool seekPacket(std::shared_ptr<FFAVDemuxer> demuxer);
     bool setDuration(std::shared_ptr<FFAVFormat> avformat);
     bool dropStreams();
+    bool runStages(const std::vector<FFAVStage>& stages, const std::vector<std::function<void()>>& aborts);
+    bool demuxStage(
+        std::shared_ptr<FFAVDemuxer> demuxer,
+        const std::unordered_map<int, std::shared_ptr<FFAVPacketQueue>>& outputs);
+    bool decodeStage(
+        std::shared_ptr<FFAVDecodeStream> stream,
+        std::shared_ptr<FFAVPacketQueue> input,
+        std::shared_ptr<FFAVFrameQueue> output);
+    bool convertStage(
+        std::shared_ptr<FFAVDecoder> decoder,
+        std::shared_ptr<FFAVFrameQueue> input,
+        std::shared_ptr<FFAVFrameQueue> output);
+    bool encodeStage(
+        std::shared_ptr<FFAVEncodeStream> stream,
+        std::shared_ptr<FFAVFrameQueue> input,
+        std::shared_ptr<FFAVPacketQueue> output,
+        int producers);
+    bool muxStage(std::shared_ptr<FFAVMuxer> muxer, std::shared_ptr<FFAVPacketQueue> input, int producers);
+    bool readStage(std::shared_ptr<FFAVDemuxer> demuxer, std::shared_ptr<FFAVPacketQueue> output);
+    bool remuxStage(const std::map<std::string, std::shared_ptr<FFAVPacketQueue>>& inputs);
+    bool remuxPipeline();
+    bool transcodePipeline();
+    int chunkStream() const;
+    std::vector<FFAVChunkRange> chunkRanges(std::shared_ptr<FFAVDemuxer> demuxer, int stream_index) const;
+    bool chunkStage(
+        const std::string& uri,
+        int stream_index,
+        std::shared_ptr<FFAVEncoder> encoder,
+        FFAVChunkRange range,
+        FFAVChunkSink sink,
+        const std::atomic_bool& aborted);
+    bool spoolStage(
+        const std::vector<std::shared_ptr<FILE>>& spools,
+        const std::vector<std::shared_ptr<FFAVQueue<bool>>>& dones,
+        AVRational time_base,
+        FFAVChunkSink sink);
+    bool transcodeChunks(int split_index);
+    void addCodecStats(
+        std::vector<FFAVStageStats>& stats,
+        const std::string& uri,
+        int stream_index,
+        const std::string& stage,
+        std::shared_ptr<FFAVCodec> codec) const;
 
 private:
     mutable std::recursive_mutex mutex_;
     std::atomic_bool debug_{false};
+    std::atomic_bool pipeline_{false};
+    std::atomic_bool accurate_seek_{false};
+    std::atomic_size_t queue_size_{8};
+    std::atomic_int chunks_{0};
+    std::atomic_bool cancelled_{false};
+    std::mutex abort_mutex_;
+    std::vector<std::function<void()>> aborts_;
+    // Changes to the format maps hold it along with mutex_, so lookups and
+    // GetStats do not wait for a running job.
+    mutable std::mutex format_mutex_;
     FFAVDemuxerMap demuxers_;
     FFAVMuxerMap muxers_;
     FFAVRuleMap rules_;
     FFAVOptionMap options_;
     std::unordered_set<std::string> optseeks_;
     std::unordered_set<std::string> optdurations_;
+    std::string trace_path_;
 };
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+struct FFAVQueueStats {
+    size_t capacity;
+    size_t size;
+    size_t high_water;
+};
+
+// Bounded blocking queue used to join pipeline stages, Push blocks while
+// the queue is full so a slow consumer throttles its producer.
+template <typename T>
+class FFAVQueue {
+public:
+    explicit FFAVQueue(size_t capacity)
+        : capacity_(capacity > 0 ? capacity : 1) {
+    }
+
+    bool Push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [&] {
+            return aborted_ || items_.size() < capacity_;
+        });
+        if (aborted_)
+            return false;
+
+        items_.push_back(std::move(item));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    bool Pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [&] {
+            return aborted_ || !items_.empty();
+        });
+        if (aborted_)
+            return false;
+
+        item = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    void Abort() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        aborted_ = true;
+        items_.clear();
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+    size_t Size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return items_.size();
+    }
+
+    size_t Capacity() const {
+        return capacity_;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    std::deque<T> items_;
+    const size_t capacity_;
+    bool aborted_{false};
+};
+
+// Bounded single-producer/single-consumer ring, Push and Pop never block and
+// fail on full/empty instead. Only one thread may push and one may pop at a
+// time, handing either side to another thread needs external ordering.
+template <typename T>
+class FFAVRingQueue {
+public:
+    explicit FFAVRingQueue(size_t capacity)
+        : items_(roundCapacity(capacity)), mask_(items_.size() - 1) {
+    }
+
+    bool Push(T&& item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - cached_head_ > mask_) {
+            cached_head_ = head_.load(std::memory_order_acquire);
+            if (tail - cached_head_ > mask_)
+                return false;
+        }
+
+        items_[tail & mask_] = std::move(item);
+        tail_.store(tail + 1, std::memory_order_release);
+
+        size_t size = tail + 1 - head_.load(std::memory_order_relaxed);
+        size_t high_water = high_water_.load(std::memory_order_relaxed);
+        if (size > high_water)
+            high_water_.store(size, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool Pop(T& item) {
+        T *front = Front();
+        if (!front)
+            return false;
+
+        size_t head = head_.load(std::memory_order_relaxed);
+        item = std::move(*front);
+        *front = T();
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    T* Front() {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == cached_tail_) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (head == cached_tail_)
+                return nullptr;
+        }
+        return &items_[head & mask_];
+    }
+
+    bool Empty() const {
+        return Size() == 0;
+    }
+
+    bool Full() const {
+        return Size() >= Capacity();
+    }
+
+    size_t Size() const {
+        size_t head = head_.load(std::memory_order_acquire);
+        size_t tail = tail_.load(std::memory_order_acquire);
+        return tail - head;
+    }
+
+    size_t Capacity() const {
+        return items_.size();
+    }
+
+    FFAVQueueStats GetStats() const {
+        return {
+            Capacity(),
+            Size(),
+            high_water_.load(std::memory_order_relaxed),
+        };
+    }
+
+private:
+    static size_t roundCapacity(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        return size;
+    }
+
+private:
+    std::vector<T> items_;
+    const size_t mask_;
+    alignas(64) std::atomic_size_t head_{0};
+    size_t cached_tail_{0};
+    alignas(64) std::atomic_size_t tail_{0};
+    size_t cached_head_{0};
+    std::atomic_size_t high_water_{0};
+};
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include "avschedule.h"
+
+std::shared_ptr<FFAVScheduler> FFAVScheduler::Create(int workers, int max_running) {
+    auto instance = std::shared_ptr<FFAVScheduler>(new FFAVScheduler());
+    if (!instance->initialize(workers, max_running))
+        return nullptr;
+    return instance;
+}
+
+FFAVScheduler::~FFAVScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+        for (const auto& [job_id, job] : jobs_) {
+            if (job->state == FFAVJobState::Running)
+                job->media->Cancel();
+        }
+        cond_.notify_all();
+    }
+
+    for (auto& worker : workers_)
+        worker.join();
+}
+
+bool FFAVScheduler::initialize(int workers, int max_running) {
+    if (workers <= 0)
+        workers = std::max(1, int(std::thread::hardware_concurrency()));
+    max_running_ = max_running > 0 ? std::min(max_running, workers) : workers;
+
+    for (int i = 0; i < workers; i++)
+        workers_.emplace_back(&FFAVScheduler::runWorker, this);
+    return true;
+}
+
+uint32_t FFAVScheduler::Submit(std::shared_ptr<FFAVMedia> media, FFAVJobType type, int priority) {
+    if (!media)
+        return 0;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopped_)
+        return 0;
+
+    // Skip 0 on wrap, it means failure to C callers.
+    uint32_t job_id = ++job_id_;
+    if (job_id == 0)
+        job_id = ++job_id_;
+
+    auto job = std::make_shared<Job>(Job{ job_id, priority, sequence_++, type, FFAVJobState::Pending, false, media });
+    jobs_[job_id] = job;
+    pendings_.insert({ -priority, job->sequence, job_id });
+    cond_.notify_all();
+    return job_id;
+}
+
+FFAVJobState FFAVScheduler::Poll(uint32_t job_id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = jobs_.find(job_id);
+    if (it == jobs_.end())
+        return FFAVJobState::Unknown;
+    return it->second->state;
+}
+
+FFAVJobState FFAVScheduler::Wait(uint32_t job_id) const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = jobs_.find(job_id);
+    if (it == jobs_.end())
+        return FFAVJobState::Unknown;
+
+    auto job = it->second;
+    cond_.wait(lock, [&] {
+        return finished(*job) || stopped_;
+    });
+    return job->state;
+}
+
+bool FFAVScheduler::Cancel(uint32_t job_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = jobs_.find(job_id);
+    if (it == jobs_.end())
+        return false;
+
+    auto job = it->second;
+    if (finished(*job))
+        return false;
+
+    job->cancelled = true;
+    if (job->state == FFAVJobState::Pending) {
+        pendings_.erase({ -job->priority, job->sequence, job_id });
+        job->state = FFAVJobState::Cancelled;
+        job->media = nullptr;
+        cond_.notify_all();
+        return true;
+    }
+
+    job->media->Cancel();
+    return true;
+}
+
+bool FFAVScheduler::Release(uint32_t job_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = jobs_.find(job_id);
+    if (it == jobs_.end() || !finished(*it->second))
+        return false;
+    jobs_.erase(it);
+    return true;
+}
+
+void FFAVScheduler::SetMaxRunning(int max_running) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int workers = int(workers_.size());
+    max_running_ = max_running > 0 ? std::min(max_running, workers) : workers;
+    cond_.notify_all();
+}
+
+size_t FFAVScheduler::GetPendingCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pendings_.size();
+}
+
+size_t FFAVScheduler::GetRunningCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return running_;
+}
+
+bool FFAVScheduler::finished(const Job& job) const {
+    return job.state == FFAVJobState::Succeeded
+        || job.state == FFAVJobState::Failed
+        || job.state == FFAVJobState::Cancelled;
+}
+
+void FFAVScheduler::runWorker() {
+    while (true) {
+        std::shared_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [&] {
+                return stopped_ || (!pendings_.empty() && running_ < size_t(max_running_));
+            });
+            if (stopped_)
+                return;
+
+            auto job_id = std::get<2>(*pendings_.begin());
+            pendings_.erase(pendings_.begin());
+            job = jobs_.at(job_id);
+            job->state = FFAVJobState::Running;
+            running_++;
+        }
+
+        bool result = false;
+        if (job->type == FFAVJobType::Remux)
+            result = job->media->Remux();
+        else if (job->type == FFAVJobType::Transcode)
+            result = job->media->Transcode();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_--;
+        if (job->cancelled)
+            job->state = FFAVJobState::Cancelled;
+        else
+            job->state = result ? FFAVJobState::Succeeded : FFAVJobState::Failed;
+        job->media = nullptr;
+        cond_.notify_all();
+    }
+}
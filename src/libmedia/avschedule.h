@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include "avmedia.h"
+
+enum class FFAVJobType {
+    Remux,
+    Transcode,
+};
+
+enum class FFAVJobState {
+    Unknown,
+    Pending,
+    Running,
+    Succeeded,
+    Failed,
+    Cancelled,
+};
+
+// Runs Remux/Transcode jobs on a fixed pool of workers. Pending jobs start
+// by descending priority then submit order, at most max_running at a time.
+class FFAVScheduler {
+    struct Job {
+        uint32_t id;
+        int priority;
+        uint64_t sequence;
+        FFAVJobType type;
+        FFAVJobState state;
+        bool cancelled;
+        std::shared_ptr<FFAVMedia> media;
+    };
+    using JobKey = std::tuple<int, uint64_t, uint32_t>;
+
+public:
+    static std::shared_ptr<FFAVScheduler> Create(int workers = 0, int max_running = 0);
+    ~FFAVScheduler();
+    uint32_t Submit(std::shared_ptr<FFAVMedia> media, FFAVJobType type, int priority = 0);
+    FFAVJobState Poll(uint32_t job_id) const;
+    FFAVJobState Wait(uint32_t job_id) const;
+    bool Cancel(uint32_t job_id);
+    bool Release(uint32_t job_id);
+    void SetMaxRunning(int max_running);
+    size_t GetPendingCount() const;
+    size_t GetRunningCount() const;
+
+private:
+    FFAVScheduler() = default;
+    bool initialize(int workers, int max_running);
+    void runWorker();
+    bool finished(const Job& job) const;
+
+private:
+    mutable std::mutex mutex_;
+    mutable std::condition_variable cond_;
+    bool stopped_{false};
+    uint32_t job_id_{0};
+    uint64_t sequence_{0};
+    int max_running_{0};
+    size_t running_{0};
+    std::set<JobKey> pendings_;
+    std::map<uint32_t, std::shared_ptr<Job>> jobs_;
+    std::vector<std::thread> workers_;
+};
@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <sstream>
+#include "avstats.h"
+
+std::atomic_bool FFAVStats::enabled_{false};
+
+void FFAVStats::SetEnabled(bool enabled) {
+    enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+bool FFAVStats::IsEnabled() {
+    return enabled_.load(std::memory_order_relaxed);
+}
+
+int64_t FFAVStats::Start() {
+    if (!IsEnabled())
+        return 0;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void FFAVStats::Record(int64_t start, int64_t items, int64_t bytes) {
+    if (start == 0)
+        return;
+
+    int64_t elapsed = Start() - start;
+    if (elapsed < 0)
+        elapsed = 0;
+
+    int bucket = std::min<int>(std::bit_width(uint64_t(elapsed / 1000)), kFFAVStatsBuckets - 1);
+    calls_.fetch_add(1, std::memory_order_relaxed);
+    items_.fetch_add(items, std::memory_order_relaxed);
+    bytes_.fetch_add(bytes, std::memory_order_relaxed);
+    time_ns_.fetch_add(elapsed, std::memory_order_relaxed);
+    histogram_[bucket].fetch_add(1, std::memory_order_relaxed);
+
+    int64_t max_ns = max_ns_.load(std::memory_order_relaxed);
+    while (elapsed > max_ns && !max_ns_.compare_exchange_weak(max_ns, elapsed, std::memory_order_relaxed)) {
+    }
+}
+
+FFAVStatsSnapshot FFAVStats::GetSnapshot() const {
+    FFAVStatsSnapshot snapshot{};
+    snapshot.calls = calls_.load(std::memory_order_relaxed);
+    snapshot.items = items_.load(std::memory_order_relaxed);
+    snapshot.bytes = bytes_.load(std::memory_order_relaxed);
+    snapshot.time_ns = time_ns_.load(std::memory_order_relaxed);
+    snapshot.max_ns = max_ns_.load(std::memory_order_relaxed);
+    for (int i = 0; i < kFFAVStatsBuckets; i++)
+        snapshot.histogram[i] = histogram_[i].load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+void FFAVStats::Reset() {
+    calls_.store(0);
+    items_.store(0);
+    bytes_.store(0);
+    time_ns_.store(0);
+    max_ns_.store(0);
+    for (auto& count : histogram_)
+        count.store(0);
+}
+
+static std::string escapeJson(const std::string& str) {
+    std::ostringstream out;
+    for (char c : str) {
+        switch (c) {
+        case '"': out << "\\\""; break;
+        case '\\': out << "\\\\"; break;
+        case '\n': out << "\\n"; break;
+        case '\t': out << "\\t"; break;
+        default:
+            if ((unsigned char)c < 0x20)
+                out << "\\u00" << "0123456789abcdef"[(c >> 4) & 0xf] << "0123456789abcdef"[c & 0xf];
+            else
+                out << c;
+        }
+    }
+    return out.str();
+}
+
+std::string DumpAVStats(const std::vector<FFAVStageStats>& stats) {
+    std::ostringstream out;
+    out << "[";
+    for (size_t i = 0; i < stats.size(); i++) {
+        const auto& item = stats[i];
+        const auto& snapshot = item.stats;
+        out << (i ? "," : "")
+            << "{\"uri\":\"" << escapeJson(item.uri) << "\""
+            << ",\"stream_index\":" << item.stream_index
+            << ",\"stage\":\"" << item.stage << "\""
+            << ",\"calls\":" << snapshot.calls
+            << ",\"items\":" << snapshot.items
+            << ",\"bytes\":" << snapshot.bytes
+            << ",\"time_ns\":" << snapshot.time_ns
+            << ",\"max_ns\":" << snapshot.max_ns
+            << ",\"queue_size\":" << snapshot.queue_size
+            << ",\"queue_high_water\":" << snapshot.queue_high_water
+            << ",\"histogram_us\":[";
+        for (int j = 0; j < kFFAVStatsBuckets; j++)
+            out << (j ? "," : "") << snapshot.histogram[j];
+        out << "]}";
+    }
+    out << "]";
+    return out.str();
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Bucket i counts calls that took less than 2^i microseconds, the last
+// bucket everything slower.
+constexpr int kFFAVStatsBuckets = 20;
+
+// items: packets or frames that came out of the call. bytes: compressed
+// bytes for demux/decode/encode/mux, output frame bytes for scale/resample.
+// queue_*: input queue of the codec, 0 for stages without one.
+struct FFAVStatsSnapshot {
+    int64_t calls;
+    int64_t items;
+    int64_t bytes;
+    int64_t time_ns;
+    int64_t max_ns;
+    int64_t queue_size;
+    int64_t queue_high_water;
+    std::array<int64_t, kFFAVStatsBuckets> histogram;
+};
+
+struct FFAVStageStats {
+    std::string uri;
+    int stream_index;
+    std::string stage;
+    FFAVStatsSnapshot stats;
+};
+
+// Call counters of one stage. Disabled by default, then Start() returns 0
+// and Record() returns at once, so only a relaxed load is paid per call.
+class FFAVStats {
+public:
+    static void SetEnabled(bool enabled);
+    static bool IsEnabled();
+    static int64_t Start();
+    void Record(int64_t start, int64_t items, int64_t bytes);
+    FFAVStatsSnapshot GetSnapshot() const;
+    void Reset();
+
+private:
+    static std::atomic_bool enabled_;
+    std::atomic_int64_t calls_{0};
+    std::atomic_int64_t items_{0};
+    std::atomic_int64_t bytes_{0};
+    std::atomic_int64_t time_ns_{0};
+    std::atomic_int64_t max_ns_{0};
+    std::array<std::atomic_int64_t, kFFAVStatsBuckets> histogram_{};
+};
+
+std::string DumpAVStats(const std::vector<FFAVStageStats>& stats);
@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include "avlog.h"
+#include "avtrace.h"
+
+static thread_local uint32_t thread_trace = 0;
+
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+FFAVTracer& FFAVTracer::GetInstance() {
+    static FFAVTracer *instance = new FFAVTracer();
+    return *instance;
+}
+
+int64_t FFAVTracer::Begin() {
+    if (thread_trace == 0)
+        return 0;
+    return nowNs();
+}
+
+void FFAVTracer::End(const char *name, int64_t begin, int stream_index, int64_t pts) {
+    if (begin == 0 || thread_trace == 0)
+        return;
+
+    int64_t end = nowNs();
+    auto& buffer = GetInstance().threadBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    if (buffer.events.size() >= kMaxEvents)
+        return;
+    buffer.events.push_back({ name, begin, end, stream_index, pts, thread_trace, buffer.tid });
+}
+
+uint32_t FFAVTracer::GetThreadTrace() {
+    return thread_trace;
+}
+
+void FFAVTracer::SetThreadTrace(uint32_t trace_id) {
+    thread_trace = trace_id;
+}
+
+uint32_t FFAVTracer::NewTrace() {
+    uint32_t trace_id = ++trace_id_;
+    if (trace_id == 0)
+        trace_id = ++trace_id_;
+    return trace_id;
+}
+
+FFAVTracer::Buffer& FFAVTracer::threadBuffer() {
+    thread_local std::shared_ptr<Buffer> buffer;
+    if (!buffer) {
+        buffer = std::make_shared<Buffer>();
+        buffer->tid = ++thread_id_;
+        std::lock_guard<std::mutex> lock(mutex_);
+        buffers_.push_back(buffer);
+    }
+    return *buffer;
+}
+
+std::vector<FFAVTraceEvent> FFAVTracer::Collect(uint32_t trace_id) {
+    std::vector<FFAVTraceEvent> events;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& buffer : buffers_) {
+        std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+        auto it = std::stable_partition(buffer->events.begin(), buffer->events.end(),
+            [trace_id](const FFAVTraceEvent& event) {
+                return event.trace_id != trace_id;
+            });
+        events.insert(events.end(), it, buffer->events.end());
+        buffer->events.erase(it, buffer->events.end());
+    }
+
+    // Buffers of exited threads are only referenced here once emptied.
+    buffers_.erase(std::remove_if(buffers_.begin(), buffers_.end(), [](const auto& buffer) {
+        std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+        return buffer.use_count() == 1 && buffer->events.empty();
+    }), buffers_.end());
+    return events;
+}
+
+bool FFAVTracer::Save(uint32_t trace_id, const std::string& path) {
+    auto events = Collect(trace_id);
+    int64_t origin = INT64_MAX;
+    for (const auto& event : events)
+        origin = std::min(origin, event.begin);
+
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::trunc);
+        if (!out) {
+            AVLogError("FFAVTracer::Save(", path, "): open failed");
+            return false;
+        }
+
+        char line[256];
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        for (size_t i = 0; i < events.size(); i++) {
+            const auto& event = events[i];
+            snprintf(line, sizeof(line),
+                "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+                "\"args\":{\"stream_index\":%d,\"pts\":%lld}}",
+                i ? "," : "", event.name, event.trace_id, event.thread_id,
+                (event.begin - origin) / 1000.0, (event.end - event.begin) / 1000.0,
+                event.stream_index, (long long)event.pts);
+            out << line;
+        }
+        out << "\n]}\n";
+        if (!out.flush()) {
+            std::remove(tmp_path.c_str());
+            AVLogError("FFAVTracer::Save(", path, "): write failed");
+            return false;
+        }
+    }
+
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        AVLogError("FFAVTracer::Save(", path, "): rename failed");
+        return false;
+    }
+    return true;
+}
+
+FFAVTraceScope::FFAVTraceScope(uint32_t trace_id)
+    : previous_(FFAVTracer::GetThreadTrace()) {
+    FFAVTracer::SetThreadTrace(trace_id);
+}
+
+FFAVTraceScope::~FFAVTraceScope() {
+    FFAVTracer::SetThreadTrace(previous_);
+}
+
+FFAVTraceSession::FFAVTraceSession(const std::string& path)
+    : path_(path) {
+    if (path_.empty())
+        return;
+    trace_id_ = FFAVTracer::GetInstance().NewTrace();
+    scope_ = std::make_unique<FFAVTraceScope>(trace_id_);
+}
+
+FFAVTraceSession::~FFAVTraceSession() {
+    if (trace_id_ == 0)
+        return;
+    scope_.reset();
+    FFAVTracer::GetInstance().Save(trace_id_, path_);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct FFAVTraceEvent {
+    const char *name;
+    int64_t begin;
+    int64_t end;
+    int stream_index;
+    int64_t pts;
+    uint32_t trace_id;
+    uint32_t thread_id;
+};
+
+// Spans are kept in per-thread buffers, tagged with the trace id of the
+// calling thread. Threads without a trace id record nothing, so Begin()
+// costs a thread-local read when tracing is off. Span names must be string
+// literals, they are stored as pointers.
+class FFAVTracer {
+    struct Buffer {
+        std::mutex mutex;
+        uint32_t tid;
+        std::vector<FFAVTraceEvent> events;
+    };
+
+public:
+    static FFAVTracer& GetInstance();
+    static int64_t Begin();
+    static void End(const char *name, int64_t begin, int stream_index, int64_t pts);
+    static uint32_t GetThreadTrace();
+    static void SetThreadTrace(uint32_t trace_id);
+    uint32_t NewTrace();
+    // Removes the spans of a trace from every buffer.
+    std::vector<FFAVTraceEvent> Collect(uint32_t trace_id);
+    // Writes the spans of a trace as Chrome/Perfetto trace event JSON.
+    bool Save(uint32_t trace_id, const std::string& path);
+
+private:
+    FFAVTracer() = default;
+    Buffer& threadBuffer();
+
+private:
+    static constexpr size_t kMaxEvents = 1 << 18;
+    std::atomic_uint32_t trace_id_{0};
+    std::atomic_uint32_t thread_id_{0};
+    std::mutex mutex_;
+    std::vector<std::shared_ptr<Buffer>> buffers_;
+};
+
+// Runs the calling thread under a trace id and restores the previous one
+// when it goes out of scope.
+class FFAVTraceScope {
+public:
+    explicit FFAVTraceScope(uint32_t trace_id);
+    ~FFAVTraceScope();
+
+private:
+    uint32_t previous_;
+};
+
+// Traces one job into path, an empty path traces nothing. The spans are
+// saved when the session ends.
+class FFAVTraceSession {
+public:
+    explicit FFAVTraceSession(const std::string& path);
+    ~FFAVTraceSession();
+
+private:
+    std::string path_;
+    uint32_t trace_id_{0};
+    std::unique_ptr<FFAVTraceScope> scope_;
+};
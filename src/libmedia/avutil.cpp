@@ -15,6 +15,34 @@ std::string AVChannelLayoutStr(const AVChannelLayout* ch_layout) {
     return std::string(buf);
 }
 
+std::shared_ptr<AVFrame> UniqueAVFrame(std::shared_ptr<AVFrame> frame) {
+    if (!frame || frame.use_count() == 1)
+        return frame;
+
+    AVFrame *newframe = av_frame_clone(frame.get());
+    if (!newframe)
+        return nullptr;
+
+    return std::shared_ptr<AVFrame>(newframe, [](AVFrame *p) {
+        av_frame_unref(p);
+        av_frame_free(&p);
+    });
+}
+
+std::shared_ptr<AVPacket> UniqueAVPacket(std::shared_ptr<AVPacket> packet) {
+    if (!packet || packet.use_count() == 1)
+        return packet;
+
+    AVPacket *newpacket = av_packet_clone(packet.get());
+    if (!newpacket)
+        return nullptr;
+
+    return std::shared_ptr<AVPacket>(newpacket, [](AVPacket *p) {
+        av_packet_unref(p);
+        av_packet_free(&p);
+    });
+}
+
 std::string DumpAVFrame(const AVFrame* frame, int stream_index, bool detailed) {
     if (!frame)
         return {};
@@ -1,10 +1,14 @@
 #pragma once
 
 #include <iostream>
+#include <memory>
 #include <string>
+#include "avlog.h"
+#include "avtrace.h"
 
 extern "C" {
 #define __STDC_CONSTANT_MACROS
+#include <libavcodec/packet.h>
 #include <libavutil/avutil.h>
 #include <libavutil/channel_layout.h>
 #include <libavutil/frame.h>
@@ -15,4 +19,6 @@ extern "C" {
 
 std::string AVErrorStr(int errnum);
 std::string AVChannelLayoutStr(const AVChannelLayout* ch_layout);
+std::shared_ptr<AVFrame> UniqueAVFrame(std::shared_ptr<AVFrame> frame);
+std::shared_ptr<AVPacket> UniqueAVPacket(std::shared_ptr<AVPacket> packet);
 std::string DumpAVFrame(const AVFrame* frame, int stream_index = -1, bool detailed = false);
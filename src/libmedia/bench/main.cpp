@@ -0,0 +1,366 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../avmedia.h"
+#include "../swresample.h"
+
+// One run of a stage: items is what the throughput is counted in, 0 when
+// the run failed.
+struct BenchRun {
+    int64_t items;
+    double wall;
+    double cpu;
+};
+
+struct BenchSummary {
+    double mean;
+    double stddev;
+    double min;
+    double max;
+};
+
+struct BenchResult {
+    std::string file;
+    std::string bench;
+    std::string unit;
+    int64_t items;
+    std::vector<BenchRun> runs;
+};
+
+static BenchSummary summarize(const std::vector<double>& values) {
+    BenchSummary summary{ 0, 0, 0, 0 };
+    if (values.empty())
+        return summary;
+
+    summary.min = *std::min_element(values.begin(), values.end());
+    summary.max = *std::max_element(values.begin(), values.end());
+    for (double value : values)
+        summary.mean += value;
+    summary.mean /= values.size();
+    if (values.size() > 1) {
+        for (double value : values)
+            summary.stddev += (value - summary.mean) * (value - summary.mean);
+        summary.stddev = std::sqrt(summary.stddev / (values.size() - 1));
+    }
+    return summary;
+}
+
+static std::string dumpSummary(const BenchSummary& summary) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(6)
+        << "{\"mean\":" << summary.mean
+        << ",\"stddev\":" << summary.stddev
+        << ",\"min\":" << summary.min
+        << ",\"max\":" << summary.max << "}";
+    return out.str();
+}
+
+static std::string dumpResult(const BenchResult& result) {
+    std::vector<double> walls, cpus, rates;
+    for (const auto& run : result.runs) {
+        walls.push_back(run.wall * 1000);
+        cpus.push_back(run.cpu * 1000);
+        rates.push_back(run.wall > 0 ? run.items / run.wall : 0);
+    }
+
+    std::ostringstream out;
+    out << "{\"file\":\"" << result.file << "\""
+        << ",\"bench\":\"" << result.bench << "\""
+        << ",\"unit\":\"" << result.unit << "\""
+        << ",\"items\":" << result.items
+        << ",\"reps\":" << result.runs.size()
+        << ",\"wall_ms\":" << dumpSummary(summarize(walls))
+        << ",\"cpu_ms\":" << dumpSummary(summarize(cpus))
+        << ",\"rate\":" << dumpSummary(summarize(rates))
+        << "}";
+    return out.str();
+}
+
+// Runs one warmup pass, then reps timed passes. A failed pass ends the
+// bench and keeps the passes done so far.
+static BenchResult runBench(
+    const std::string& file,
+    const std::string& bench,
+    const std::string& unit,
+    int reps,
+    const std::function<int64_t()>& pass) {
+    BenchResult result{ file, bench, unit, pass(), {} };
+    if (result.items <= 0)
+        return result;
+
+    for (int i = 0; i < reps; i++) {
+        auto wall_start = std::chrono::steady_clock::now();
+        std::clock_t cpu_start = std::clock();
+        int64_t items = pass();
+        double cpu = double(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+        double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+        if (items <= 0)
+            break;
+        result.runs.push_back({ items, wall, cpu });
+    }
+    return result;
+}
+
+// Packets written by the muxers of a media, counted by its mux stats.
+static int64_t muxedPackets(std::shared_ptr<FFAVMedia> media) {
+    int64_t packets = 0;
+    for (const auto& item : media->GetStats()) {
+        if (item.stage == "mux")
+            packets += item.stats.items;
+    }
+    return packets;
+}
+
+static int bestStream(std::shared_ptr<FFAVDemuxer> demuxer, AVMediaType type) {
+    return av_find_best_stream(demuxer->GetContext().get(), type, -1, -1, nullptr, 0);
+}
+
+static std::shared_ptr<FFAVDemuxer> openStream(const std::string& uri, AVMediaType type, int& stream_index) {
+    auto demuxer = FFAVDemuxer::Create(uri);
+    if (!demuxer)
+        return nullptr;
+
+    stream_index = bestStream(demuxer, type);
+    if (stream_index < 0)
+        return nullptr;
+
+    for (auto index : demuxer->GetStreamIndexes()) {
+        if (index != stream_index)
+            demuxer->DropStream(index);
+    }
+    if (!demuxer->GetDecodeStream(stream_index, {.thread_count = 0}))
+        return nullptr;
+    return demuxer;
+}
+
+static int64_t benchDemux(const std::string& uri) {
+    auto demuxer = FFAVDemuxer::Create(uri);
+    if (!demuxer)
+        return 0;
+
+    int64_t packets = 0;
+    while (demuxer->ReadPacket())
+        packets++;
+    return demuxer->PacketEOF() ? packets : 0;
+}
+
+static int64_t benchDecode(const std::string& uri) {
+    int stream_index = -1;
+    auto demuxer = openStream(uri, AVMEDIA_TYPE_VIDEO, stream_index);
+    if (!demuxer)
+        return 0;
+
+    int64_t frames = 0;
+    while (demuxer->ReadFrame().second)
+        frames++;
+    return demuxer->FrameEOF() ? frames : 0;
+}
+
+static std::vector<std::shared_ptr<AVFrame>> decodeFrames(const std::string& uri, AVMediaType type, size_t count) {
+    std::vector<std::shared_ptr<AVFrame>> frames;
+    int stream_index = -1;
+    auto demuxer = openStream(uri, type, stream_index);
+    if (!demuxer)
+        return frames;
+
+    while (frames.size() < count) {
+        auto frame = demuxer->ReadFrame().second;
+        if (!frame)
+            break;
+        frames.push_back(frame);
+    }
+    return frames;
+}
+
+static int64_t benchScale(const std::vector<std::shared_ptr<AVFrame>>& frames) {
+    if (frames.empty())
+        return 0;
+
+    const auto& first = frames.front();
+    FFSWScale swscale(
+        first->width, first->height, (AVPixelFormat)first->format,
+        first->width / 2, first->height / 2, AV_PIX_FMT_YUV420P,
+        SWS_BILINEAR);
+    if (!swscale.Init())
+        return 0;
+
+    int64_t count = 0;
+    for (const auto& frame : frames) {
+        if (!swscale.Scale(frame, 0, frame->height, 32))
+            return 0;
+        count++;
+    }
+    return count;
+}
+
+static int64_t benchResample(const std::vector<std::shared_ptr<AVFrame>>& frames) {
+    if (frames.empty())
+        return 0;
+
+    const auto& first = frames.front();
+    AVChannelLayout stereo = AV_CHANNEL_LAYOUT_STEREO;
+    FFSWResample swresample(
+        first->ch_layout, (AVSampleFormat)first->format, first->sample_rate,
+        stereo, AV_SAMPLE_FMT_S16, 44100);
+    if (!swresample.Init())
+        return 0;
+
+    int64_t samples = 0;
+    for (const auto& frame : frames) {
+        if (!swresample.Convert(frame))
+            return 0;
+        samples += frame->nb_samples;
+    }
+    return samples;
+}
+
+static int64_t benchRemux(const std::string& uri, const std::string& dst_uri) {
+    auto m = FFAVMedia::Create();
+    auto demuxer = m->AddDemuxer(uri);
+    auto muxer = m->AddMuxer(dst_uri, "mp4");
+    if (!demuxer || !muxer)
+        return 0;
+
+    for (auto i : demuxer->GetStreamIndexes()) {
+        auto src_stream = demuxer->GetDemuxStream(i)->GetStream();
+        auto type = src_stream->codecpar->codec_type;
+        if (type != AVMEDIA_TYPE_VIDEO && type != AVMEDIA_TYPE_AUDIO) {
+            demuxer->DropStream(i);
+            continue;
+        }
+
+        auto dst_muxstream = muxer->AddMuxStream();
+        dst_muxstream->SetParameters(*src_stream->codecpar);
+        m->AddRule({ uri, i }, { dst_uri, dst_muxstream->GetIndex() });
+    }
+    if (!m->Remux())
+        return 0;
+    return muxedPackets(m);
+}
+
+static int64_t benchTranscode(const std::string& uri, const std::string& dst_uri) {
+    auto m = FFAVMedia::Create();
+    auto demuxer = m->AddDemuxer(uri);
+    auto muxer = m->AddMuxer(dst_uri, "mp4");
+    if (!demuxer || !muxer)
+        return 0;
+
+    int video_index = bestStream(demuxer, AVMEDIA_TYPE_VIDEO);
+    if (video_index < 0)
+        return 0;
+
+    for (auto i : demuxer->GetStreamIndexes()) {
+        if (i != video_index)
+            demuxer->DropStream(i);
+    }
+
+    auto decodestream = demuxer->GetDecodeStream(video_index, {.thread_count = 0});
+    if (!decodestream)
+        return 0;
+
+    auto src_codecpar = decodestream->GetStream()->codecpar;
+    AVCodecParameters dst_codecpar{};
+    dst_codecpar.codec_type = AVMEDIA_TYPE_VIDEO;
+    dst_codecpar.codec_id = AV_CODEC_ID_H264;
+    dst_codecpar.format = AV_PIX_FMT_YUV420P;
+    dst_codecpar.bit_rate = 1000000;
+    dst_codecpar.width = src_codecpar->width;
+    dst_codecpar.height = src_codecpar->height;
+    dst_codecpar.framerate = { 30, 1 };
+    dst_codecpar.sample_aspect_ratio = { 1, 1 };
+
+    auto encodestream = muxer->AddEncodeStream(dst_codecpar.codec_id);
+    if (!encodestream || !encodestream->GetEncoder()->SetParameters(dst_codecpar))
+        return 0;
+    encodestream->GetEncoder()->SetProfile(FFAVEncodeProfile::Throughput);
+
+    m->AddRule({ uri, video_index }, { dst_uri, encodestream->GetIndex() });
+    if (!m->Transcode())
+        return 0;
+    return muxedPackets(m);
+}
+
+static std::vector<std::string> listFiles(const std::string& dir) {
+    std::vector<std::string> files;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+        auto ext = entry.path().extension().string();
+        if (entry.is_regular_file() && (ext == ".mp4" || ext == ".mov"))
+            files.push_back(entry.path().string());
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+// Usage: media_bench [reps] [dir...], prints one JSON document to stdout.
+int main(int argc, char *argv[]) {
+    int reps = argc > 1 ? std::max(1, atoi(argv[1])) : 5;
+    std::vector<std::string> dirs;
+    for (int i = 2; i < argc; i++)
+        dirs.push_back(argv[i]);
+    if (dirs.empty())
+        dirs = { "/opt/ffmpeg/sample/tiny", "/opt/ffmpeg/sample/mp4" };
+
+    // Keep stdout for the JSON report, remux/transcode count their output
+    // with the mux stats.
+    FFAVLog::GetInstance().SetLevel(FFAVLogLevel::Error);
+    FFAVStats::SetEnabled(true);
+    av_log_set_level(AV_LOG_ERROR);
+
+    auto tmp_dir = std::filesystem::temp_directory_path();
+    auto dst_uri = (tmp_dir / "media_bench.mp4").string();
+
+    std::vector<BenchResult> results;
+    for (const auto& dir : dirs) {
+        for (const auto& file : listFiles(dir)) {
+            std::cerr << "bench " << file << std::endl;
+            results.push_back(runBench(file, "demux", "packets", reps, [&] {
+                return benchDemux(file);
+            }));
+            results.push_back(runBench(file, "decode", "frames", reps, [&] {
+                return benchDecode(file);
+            }));
+
+            auto video_frames = decodeFrames(file, AVMEDIA_TYPE_VIDEO, 120);
+            results.push_back(runBench(file, "scale", "frames", reps, [&] {
+                return benchScale(video_frames);
+            }));
+            video_frames.clear();
+
+            auto audio_frames = decodeFrames(file, AVMEDIA_TYPE_AUDIO, 500);
+            results.push_back(runBench(file, "resample", "samples", reps, [&] {
+                return benchResample(audio_frames);
+            }));
+            audio_frames.clear();
+
+            results.push_back(runBench(file, "remux", "packets", reps, [&] {
+                return benchRemux(file, dst_uri);
+            }));
+            results.push_back(runBench(file, "transcode", "packets", reps, [&] {
+                return benchTranscode(file, dst_uri);
+            }));
+        }
+    }
+    std::filesystem::remove(dst_uri);
+
+    std::cout << "{\"reps\":" << reps << ",\"results\":[";
+    bool first = true;
+    for (const auto& result : results) {
+        if (result.runs.empty())
+            continue;
+        std::cout << (first ? "\n" : ",\n") << dumpResult(result);
+        first = false;
+    }
+    std::cout << "\n]}" << std::endl;
+
+    FFAVLog::GetInstance().Flush();
+    return 0;
+}
@@ -23,6 +23,31 @@ bool AddDemuxer(uint32_t media_id, const char* uri) {
     return bool(media->AddDemuxer(uri));
 }
 
+bool AddDemuxerFromBuffer(uint32_t media_id, const char* uri, const uint8_t* data, size_t size) {
+    auto media = MediaManager::GetInstance().GetMedia(media_id);
+    if (!media)
+        return false;
+
+    auto io = FFAVMemoryIO::Create(data, size);
+    if (!io)
+        return false;
+
+    return bool(media->AddDemuxer(uri, io));
+}
+
+bool AddDemuxerFromCallbacks(uint32_t media_id, const char* uri,
+    void* opaque, MediaReadCallback read, MediaSeekCallback seek) {
+    auto media = MediaManager::GetInstance().GetMedia(media_id);
+    if (!media)
+        return false;
+
+    auto io = FFAVCallbackIO::Create(opaque, read, seek);
+    if (!io)
+        return false;
+
+    return bool(media->AddDemuxer(uri, io));
+}
+
 bool AddMuxer(uint32_t media_id, const char* uri, const char* mux_fmt) {
     auto media = MediaManager::GetInstance().GetMedia(media_id);
     if (!media)
@@ -89,6 +114,140 @@ const AVPacket* ReadPacket(uint32_t media_id, const char* uri) {
     return av_packet_clone(packet.get());
 }
 
+int ReadPacketInto(uint32_t media_id, const char* uri, AVPacket* packet) {
+    if (!packet)
+        return AVERROR(EINVAL);
+
+    auto media = MediaManager::GetInstance().GetMedia(media_id);
+    if (!media)
+        return AVERROR(EINVAL);
+
+    auto demuxer = media->GetDemuxer(uri);
+    if (!demuxer)
+        return AVERROR(EINVAL);
+
+    auto pkt = demuxer->ReadPacket();
+    if (!pkt)
+        return demuxer->PacketEOF() ? AVERROR_EOF : AVERROR_UNKNOWN;
+
+    // A packet still shared inside the pipeline gets a new ref instead.
+    if (pkt.use_count() == 1) {
+        av_packet_move_ref(packet, pkt.get());
+        return 0;
+    }
+    return av_packet_ref(packet, pkt.get());
+}
+
+int ReadPackets(uint32_t media_id, const char* uri, AVPacket** packets, int max) {
+    if (!packets || max <= 0)
+        return AVERROR(EINVAL);
+
+    auto media = MediaManager::GetInstance().GetMedia(media_id);
+    if (!media)
+        return AVERROR(EINVAL);
+
+    auto demuxer = media->GetDemuxer(uri);
+    if (!demuxer)
+        return AVERROR(EINVAL);
+
+    int count = 0;
+    while (count < max) {
+        auto pkt = demuxer->ReadPacket();
+        if (!pkt) {
+            if (count > 0)
+                break;
+            return demuxer->PacketEOF() ? AVERROR_EOF : AVERROR_UNKNOWN;
+        }
+
+        if (pkt.use_count() == 1) {
+            av_packet_move_ref(packets[count], pkt.get());
+        } else {
+            int ret = av_packet_ref(packets[count], pkt.get());
+            if (ret < 0)
+                return count > 0 ? count : ret;
+        }
+        count++;
+    }
+    return count;
+}
+
+int ReadFrames(uint32_t media_id, const char* uri, AVFrame** frames, int32_t* stream_indexes, int max) {
+    if (!frames || max <= 0)
+        return AVERROR(EINVAL);
+
+    auto media = MediaManager::GetInstance().GetMedia(media_id);
+    if (!media)
+        return AVERROR(EINVAL);
+
+    auto demuxer = media->GetDemuxer(uri);
+    if (!demuxer)
+        return AVERROR(EINVAL);
+
+    int count = 0;
+    while (count < max) {
+        auto [stream_index, frame] = demuxer->ReadFrame();
+        if (!frame) {
+            if (count > 0)
+                break;
+            return demuxer->FrameEOF() ? AVERROR_EOF : AVERROR_UNKNOWN;
+        }
+
+        if (frame.use_count() == 1) {
+            av_frame_move_ref(frames[count], frame.get());
+        } else {
+            int ret = av_frame_ref(frames[count], frame.get());
+            if (ret < 0)
+                return count > 0 ? count : ret;
+        }
+        if (stream_indexes)
+            stream_indexes[count] = stream_index;
+        count++;
+    }
+    return count;
+}
+
+int WritePackets(uint32_t media_id, const char* uri, AVPacket** packets, int count) {
+    if (!packets || count < 0)
+        return AVERROR(EINVAL);
+
+    auto media = MediaManager::GetInstance().GetMedia(media_id);
+    if (!media)
+        return AVERROR(EINVAL);
+
+    auto muxer = media->GetMuxer(uri);
+    if (!muxer)
+        return AVERROR(EINVAL);
+
+    // Nothing may follow the trailer.
+    for (int i = 0; i + 1 < count; i++) {
+        if (!packets[i])
+            return AVERROR(EINVAL);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (!packets[i]) {
+            if (!muxer->WritePacket(nullptr))
+                return i > 0 ? i : AVERROR_UNKNOWN;
+            return i + 1;
+        }
+
+        auto stream = muxer->GetMuxStream(packets[i]->stream_index);
+        if (!stream)
+            return i > 0 ? i : AVERROR(EINVAL);
+
+        // Borrowed, the muxer rewrites the packet in place and moves its
+        // reference out when writing.
+        auto packet = std::shared_ptr<AVPacket>(packets[i], [](AVPacket*) {});
+        if (packet->time_base.num == 0 || packet->time_base.den == 0)
+            packet->time_base = stream->GetTimeBase();
+        bool written = muxer->WritePacket(std::move(packet));
+        av_packet_unref(packets[i]);
+        if (!written)
+            return i > 0 ? i : AVERROR_UNKNOWN;
+    }
+    return count;
+}
+
 void FreePacket(AVPacket* packet) {
     if (packet) {
         av_packet_unref(packet);
@@ -116,6 +275,143 @@ bool SetPlaySpeed(uint32_t media_id, const char* uri, double speed) {
     return false;
 }
 
+template <typename T>
+static std::vector<T*> rawItems(const std::vector<std::shared_ptr<T>>& items) {
+    std::vector<T*> raws;
+    raws.reserve(items.size());
+    for (const auto& item : items)
+        raws.push_back(item.get());
+    return raws;
+}
+
+bool SetTraceFile(uint32_t media_id, const char* path) {
+    auto media = MediaManager::GetInstance().GetMedia(media_id);
+    if (!media)
+        return false;
+    media->SetTrace(path ? path : "");
+    return true;
+}
+
+bool SetPacketCallback(uint32_t media_id, const char* uri, int32_t stream_index,
+    void* opaque, MediaPacketCallback callback, int32_t batch_size) {
+    auto media = MediaManager::GetInstance().GetMedia(media_id);
+    if (!media || !callback)
+        return false;
+
+    auto demuxer = media->GetDemuxer(uri);
+    if (!demuxer)
+        return false;
+
+    return demuxer->SetPacketSink(stream_index,
+        [opaque, callback](int index, std::vector<std::shared_ptr<AVPacket>>& packets) {
+            auto raws = rawItems(packets);
+            return static_cast<FFAVSinkStatus>(callback(opaque, index, raws.data(), int(raws.size())));
+        },
+        batch_size > 0 ? batch_size : 1);
+}
+
+bool SetFrameCallback(uint32_t media_id, const char* uri, int32_t stream_index,
+    void* opaque, MediaFrameCallback callback, int32_t batch_size) {
+    auto media = MediaManager::GetInstance().GetMedia(media_id);
+    if (!media || !callback)
+        return false;
+
+    auto demuxer = media->GetDemuxer(uri);
+    if (!demuxer)
+        return false;
+
+    return demuxer->SetFrameSink(stream_index,
+        [opaque, callback](int index, std::vector<std::shared_ptr<AVFrame>>& frames) {
+            auto raws = rawItems(frames);
+            return static_cast<FFAVSinkStatus>(callback(opaque, index, raws.data(), int(raws.size())));
+        },
+        batch_size > 0 ? batch_size : 1);
+}
+
+enum MediaPumpStatus PumpMedia(uint32_t media_id, const char* uri, int32_t max_packets) {
+    auto media = MediaManager::GetInstance().GetMedia(media_id);
+    if (!media)
+        return MEDIA_PUMP_ERROR;
+
+    auto demuxer = media->GetDemuxer(uri);
+    if (!demuxer)
+        return MEDIA_PUMP_ERROR;
+
+    return static_cast<MediaPumpStatus>(demuxer->Pump(max_packets > 0 ? max_packets : 0));
+}
+
+uint32_t SubmitJob(uint32_t media_id, enum MediaJobType type, int32_t priority) {
+    auto& manager = MediaManager::GetInstance();
+    auto media = manager.GetMedia(media_id);
+    auto scheduler = manager.GetScheduler();
+    if (!media || !scheduler)
+        return 0;
+
+    auto job_type = type == MEDIA_JOB_TRANSCODE ? FFAVJobType::Transcode : FFAVJobType::Remux;
+    return scheduler->Submit(media, job_type, priority);
+}
+
+enum MediaJobState PollJob(uint32_t job_id) {
+    auto scheduler = MediaManager::GetInstance().GetScheduler();
+    if (!scheduler)
+        return MEDIA_JOB_UNKNOWN;
+    return static_cast<MediaJobState>(scheduler->Poll(job_id));
+}
+
+enum MediaJobState WaitJob(uint32_t job_id) {
+    auto scheduler = MediaManager::GetInstance().GetScheduler();
+    if (!scheduler)
+        return MEDIA_JOB_UNKNOWN;
+    return static_cast<MediaJobState>(scheduler->Wait(job_id));
+}
+
+bool CancelJob(uint32_t job_id) {
+    auto scheduler = MediaManager::GetInstance().GetScheduler();
+    if (!scheduler)
+        return false;
+    return scheduler->Cancel(job_id);
+}
+
+bool ReleaseJob(uint32_t job_id) {
+    auto scheduler = MediaManager::GetInstance().GetScheduler();
+    if (!scheduler)
+        return false;
+    return scheduler->Release(job_id);
+}
+
+bool SetMaxRunningJobs(int32_t max_running) {
+    auto scheduler = MediaManager::GetInstance().GetScheduler();
+    if (!scheduler)
+        return false;
+    scheduler->SetMaxRunning(max_running);
+    return true;
+}
+
+void SetLogLevel(enum MediaLogLevel level) {
+    FFAVLog::GetInstance().SetLevel(static_cast<FFAVLogLevel>(level));
+}
+
+void FlushLog() {
+    FFAVLog::GetInstance().Flush();
+}
+
+void SetStatsEnabled(bool enabled) {
+    FFAVStats::SetEnabled(enabled);
+}
+
+const char* AllocStatsStr(uint32_t media_id) {
+    auto media = MediaManager::GetInstance().GetMedia(media_id);
+    if (!media)
+        return nullptr;
+
+    auto str = DumpAVStats(media->GetStats());
+    char *buf = (char*)malloc(str.size() + 1);
+    if (!buf)
+        return nullptr;
+    memcpy(buf, str.c_str(), str.size() + 1);
+    return buf;
+}
+
 const char* GetPacketSideDataTypeStr(const AVPacketSideData* side_data) {
     if (!side_data)
         return nullptr;
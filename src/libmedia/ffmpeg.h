@@ -15,17 +15,109 @@ extern "C" {
 #include <libavutil/avutil.h>
 #include <libavutil/pixdesc.h>
 
+typedef int (*MediaReadCallback)(void* opaque, uint8_t* buf, int buf_size);
+typedef int64_t (*MediaSeekCallback)(void* opaque, int64_t offset, int whence);
+
+enum MediaLogLevel {
+    MEDIA_LOG_DEBUG,
+    MEDIA_LOG_INFO,
+    MEDIA_LOG_WARNING,
+    MEDIA_LOG_ERROR,
+    MEDIA_LOG_QUIET,
+};
+
+enum MediaSinkStatus {
+    MEDIA_SINK_ACCEPTED,
+    MEDIA_SINK_BUSY,
+    MEDIA_SINK_STOP,
+};
+
+enum MediaPumpStatus {
+    MEDIA_PUMP_AGAIN,
+    MEDIA_PUMP_BUSY,
+    MEDIA_PUMP_STOPPED,
+    MEDIA_PUMP_END,
+    MEDIA_PUMP_ERROR,
+};
+
+// Items are borrowed for the call, av_packet_ref/av_frame_ref what is kept.
+// MEDIA_SINK_BUSY hands the same batch again on the next PumpMedia.
+typedef enum MediaSinkStatus (*MediaPacketCallback)(void* opaque, int32_t stream_index, AVPacket** packets, int count);
+typedef enum MediaSinkStatus (*MediaFrameCallback)(void* opaque, int32_t stream_index, AVFrame** frames, int count);
+
+enum MediaJobType {
+    MEDIA_JOB_REMUX,
+    MEDIA_JOB_TRANSCODE,
+};
+
+enum MediaJobState {
+    MEDIA_JOB_UNKNOWN,
+    MEDIA_JOB_PENDING,
+    MEDIA_JOB_RUNNING,
+    MEDIA_JOB_SUCCEEDED,
+    MEDIA_JOB_FAILED,
+    MEDIA_JOB_CANCELLED,
+};
+
 uint32_t CreateMedia();
 bool DeleteMedia(uint32_t media_id);
 bool AddDemuxer(uint32_t media_id, const char* uri);
+// uri only names the input and hints the format, data is read in place
+// and must stay valid until the format or media is deleted.
+bool AddDemuxerFromBuffer(uint32_t media_id, const char* uri, const uint8_t* data, size_t size);
+// read returns the bytes read, 0 or AVERROR_EOF at the end, seek follows
+// AVIOContext semantics including AVSEEK_SIZE and may be NULL.
+bool AddDemuxerFromCallbacks(uint32_t media_id, const char* uri,
+    void* opaque, MediaReadCallback read, MediaSeekCallback seek);
 bool AddMuxer(uint32_t media_id, const char* uri, const char* mux_fmt);
 bool DeleteFormat(uint32_t media_id, const char* uri);
 const AVFormatContext* GetFormatContext(uint32_t media_id, const char* uri);
 const AVStream* GetStream(uint32_t media_id, const char* uri, int32_t stream_index);
 const AVCodecParameters* GetCodecParameters(uint32_t media_id, const char* uri, int32_t stream_index);
 const AVPacket* ReadPacket(uint32_t media_id, const char* uri);
+// Moves the next packet's reference into a caller-owned packet, which must
+// be blank or unreferenced and is av_packet_unref'ed by the caller.
+// Returns 0, AVERROR_EOF at the end or another negative AVERROR.
+int ReadPacketInto(uint32_t media_id, const char* uri, AVPacket* packet);
+// Batched reads fill up to max caller-owned items like ReadPacketInto and
+// return how many were filled, AVERROR_EOF once nothing is left or another
+// negative AVERROR when the first read fails.
+int ReadPackets(uint32_t media_id, const char* uri, AVPacket** packets, int max);
+int ReadFrames(uint32_t media_id, const char* uri, AVFrame** frames, int32_t* stream_indexes, int max);
+// Writes count packets in order and returns how many were written, each is
+// consumed and left blank. A NULL last entry finishes the muxer, a NULL
+// anywhere else fails with AVERROR(EINVAL) before writing. time_base may
+// be left 0/0 to mean the stream's time base.
+int WritePackets(uint32_t media_id, const char* uri, AVPacket** packets, int count);
 void FreePacket(AVPacket* packet);
 bool SetPlaySpeed(uint32_t media_id, const char* uri, double speed);
+// Remux/Transcode of the media write their spans to path as Chrome trace
+// JSON when they end, NULL or "" turns tracing off.
+bool SetTraceFile(uint32_t media_id, const char* path);
+bool SetPacketCallback(uint32_t media_id, const char* uri, int32_t stream_index,
+    void* opaque, MediaPacketCallback callback, int32_t batch_size);
+bool SetFrameCallback(uint32_t media_id, const char* uri, int32_t stream_index,
+    void* opaque, MediaFrameCallback callback, int32_t batch_size);
+// Pushes packets/frames to the callbacks until max_packets were read (0 for
+// no limit), a callback returns BUSY or STOP, or the input ends.
+enum MediaPumpStatus PumpMedia(uint32_t media_id, const char* uri, int32_t max_packets);
+
+// Jobs run on a shared worker pool, higher priority first. A finished job
+// keeps its state until released, the media may be deleted meanwhile.
+uint32_t SubmitJob(uint32_t media_id, enum MediaJobType type, int32_t priority);
+enum MediaJobState PollJob(uint32_t job_id);
+enum MediaJobState WaitJob(uint32_t job_id);
+bool CancelJob(uint32_t job_id);
+bool ReleaseJob(uint32_t job_id);
+bool SetMaxRunningJobs(int32_t max_running);
+// Stats are process-wide and off by default. AllocStatsStr returns a JSON
+// array of per-stream stage counters, release it with free().
+void SetStatsEnabled(bool enabled);
+const char* AllocStatsStr(uint32_t media_id);
+// Library messages are written by a background thread, FlushLog waits
+// until everything logged so far is out.
+void SetLogLevel(enum MediaLogLevel level);
+void FlushLog();
 
 const char* GetPacketSideDataTypeStr(const AVPacketSideData* side_data);
 const char* GetFieldOrderStr(enum AVFieldOrder order);
@@ -23,10 +23,9 @@ bool FFSWResample::Init() {
         return false;
     }
 
-    if (swr_init(context) < 0) {
-        char errbuf[AV_ERROR_MAX_STRING_SIZE];
-        av_strerror(ret, errbuf, sizeof(errbuf));
-        fprintf(stderr, "Error initializing SwrContext: %s\n", errbuf);
+    ret = swr_init(context);
+    if (ret < 0) {
+        AVLogError("swr_init: ", AVErrorStr(ret));
         swr_free(&context);
         return false;
     }
@@ -47,6 +46,7 @@ std::shared_ptr<AVFrame> FFSWResample::Convert(std::shared_ptr<AVFrame> src_fram
         || src_ch_layout_.nb_channels != src_frame->ch_layout.nb_channels)
         return nullptr;
 
+    int64_t start = FFAVStats::Start();
     AVFrame *dst_frame = av_frame_alloc();
     if (!dst_frame)
         return nullptr;
@@ -59,11 +59,14 @@ std::shared_ptr<AVFrame> FFSWResample::Convert(std::shared_ptr<AVFrame> src_fram
         AV_ROUND_UP
     );
 
-    av_frame_make_writable(dst_frame);
     dst_frame->nb_samples = dst_nb_samples;
     dst_frame->ch_layout = dst_ch_layout_;
     dst_frame->format = dst_sample_fmt_;
     dst_frame->sample_rate = dst_sample_rate_;
+    if (av_frame_get_buffer(dst_frame, 0) < 0) {
+        av_frame_free(&dst_frame);
+        return nullptr;
+    }
 
     int ret = swr_convert(
         context_.get(),
@@ -76,9 +79,16 @@ std::shared_ptr<AVFrame> FFSWResample::Convert(std::shared_ptr<AVFrame> src_fram
         av_frame_free(&dst_frame);
         return nullptr;
     }
+    dst_frame->nb_samples = ret;
+
+    stats_.Record(start, 1, av_samples_get_buffer_size(nullptr, dst_ch_layout_.nb_channels, ret, dst_sample_fmt_, 1));
 
     std::shared_ptr<AVFrame> dst_frame_ptr(dst_frame, [](AVFrame *p) {
         av_frame_free(&p);
     });
     return dst_frame_ptr;
 }
+
+FFAVStatsSnapshot FFSWResample::GetStats() const {
+    return stats_.GetSnapshot();
+}
@@ -4,6 +4,8 @@
 #include <iostream>
 #include <memory>
 #include <mutex>
+#include "avstats.h"
+#include "avutil.h"
 extern "C" {
 #define __STDC_CONSTANT_MACROS
 #include <libswresample/swresample.h>
@@ -18,6 +20,7 @@ public:
         const AVChannelLayout& dst_ch_layout, AVSampleFormat dst_sample_fmt, int dst_sample_rate);
     bool Init();
     std::shared_ptr<AVFrame> Convert(std::shared_ptr<AVFrame> src_frame);
+    FFAVStatsSnapshot GetStats() const;
 
 private:
     mutable std::recursive_mutex mutex_;
@@ -28,4 +31,5 @@ private:
     AVChannelLayout src_ch_layout_;
     AVChannelLayout dst_ch_layout_;
     SwrContextPtr context_;
+    FFAVStats stats_;
 };
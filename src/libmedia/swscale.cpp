@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cstring>
 #include "swscale.h"
 
 FFSWScale::FFSWScale(
@@ -10,6 +12,16 @@ FFSWScale::FFSWScale(
   , flags_(flags) {
 }
 
+FFSWScale::~FFSWScale() {
+    {
+        std::lock_guard<std::mutex> lock(slice_mutex_);
+        slice_exit_ = true;
+    }
+    slice_start_.notify_all();
+    for (auto& worker : slice_workers_)
+        worker.join();
+}
+
 bool FFSWScale::SetSrcFilter(
     float luma_gblur, float chroma_gblur, float luma_sharpen,
     float chroma_sharpen, float chroma_hshift, float chroma_vshift,
@@ -58,6 +70,14 @@ bool FFSWScale::SetParams(const std::vector<double>& params) {
     return true;
 }
 
+bool FFSWScale::SetThreads(int threads) {
+    if (context_) return false;
+
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    threads_ = threads > 0 ? threads : 1;
+    return true;
+}
+
 bool FFSWScale::Init() {
     std::lock_guard<std::recursive_mutex> lock(mutex_);
     SwsFilter *src_filter = src_filter_ ? src_filter_.get() : nullptr;
@@ -74,9 +94,193 @@ bool FFSWScale::Init() {
     context_ = SwsContextPtr(context, [](SwsContext *ctx) {
         sws_freeContext(ctx);
     });
+    return initSlices();
+}
+
+bool FFSWScale::initSlices() {
+    if (threads_ <= 1)
+        return true;
+
+    SwsFilter *src_filter = src_filter_ ? src_filter_.get() : nullptr;
+    SwsFilter *dst_filter = dst_filter_ ? dst_filter_.get() : nullptr;
+    const double *params = params_.empty() ? nullptr : params_.data();
+    for (int i = 0; i < threads_; i++) {
+        struct SwsContext* context = sws_getContext(
+            src_width_, src_height_, src_pix_fmt_,
+            dst_width_, dst_height_, dst_pix_fmt_,
+            flags_, src_filter, dst_filter, params
+        );
+        if (!context) {
+            slice_contexts_.clear();
+            return false;
+        }
+
+        slice_contexts_.emplace_back(context, [](SwsContext *ctx) {
+            sws_freeContext(ctx);
+        });
+    }
+
+    slice_align_ = sws_receive_slice_alignment(slice_contexts_[0].get());
+    for (int i = 1; i < threads_; i++)
+        slice_workers_.emplace_back(&FFSWScale::runSlices, this, i);
+    return true;
+}
+
+void FFSWScale::runSlices(int slice_index) {
+    uint64_t generation = 0;
+    while (true) {
+        AVFrame *src_frame = nullptr;
+        AVFrame *dst_frame = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(slice_mutex_);
+            slice_start_.wait(lock, [&] {
+                return slice_exit_ || slice_generation_ != generation;
+            });
+            if (slice_exit_)
+                return;
+            generation = slice_generation_;
+            src_frame = slice_src_;
+            dst_frame = slice_dst_;
+        }
+
+        int ret = scaleSlice(slice_index, src_frame, dst_frame);
+
+        std::lock_guard<std::mutex> lock(slice_mutex_);
+        if (ret < 0)
+            slice_result_ = ret;
+        if (--slice_pending_ == 0)
+            slice_done_.notify_one();
+    }
+}
+
+int FFSWScale::scaleSlice(int slice_index, AVFrame *src_frame, AVFrame *dst_frame) {
+    int slice_height = (dst_height_ + threads_ - 1) / threads_;
+    slice_height = (slice_height + slice_align_ - 1) / slice_align_ * slice_align_;
+    int slice_start = slice_index * slice_height;
+    if (slice_start >= dst_height_)
+        return 0;
+    slice_height = std::min(slice_height, dst_height_ - slice_start);
+
+    // Every slice context reads the whole source picture and only
+    // produces its own band of destination lines.
+    SwsContext *context = slice_contexts_[slice_index].get();
+    int ret = sws_frame_start(context, dst_frame, src_frame);
+    if (ret < 0)
+        return ret;
+
+    ret = sws_send_slice(context, 0, src_frame->height);
+    if (ret >= 0)
+        ret = sws_receive_slice(context, slice_start, slice_height);
+
+    sws_frame_end(context);
+    return ret;
+}
+
+int FFSWScale::scaleSlices(AVFrame *src_frame, AVFrame *dst_frame) {
+    {
+        std::lock_guard<std::mutex> lock(slice_mutex_);
+        slice_src_ = src_frame;
+        slice_dst_ = dst_frame;
+        slice_result_ = 0;
+        slice_pending_ = threads_ - 1;
+        slice_generation_++;
+    }
+    slice_start_.notify_all();
+
+    int ret = scaleSlice(0, src_frame, dst_frame);
+
+    std::unique_lock<std::mutex> lock(slice_mutex_);
+    slice_done_.wait(lock, [&] {
+        return slice_pending_ == 0;
+    });
+    return ret < 0 ? ret : slice_result_;
+}
+
+AVBufferRef* FFSWScale::allocBuffer(void *opaque, size_t size) {
+    auto self = static_cast<FFSWScale*>(opaque);
+    auto data = static_cast<uint8_t*>(av_malloc(size));
+    if (!data)
+        return nullptr;
+
+    auto counters = new std::shared_ptr<PoolCounters>(self->counters_);
+    AVBufferRef *buf = av_buffer_create(data, size, freeBuffer, counters, 0);
+    if (!buf) {
+        delete counters;
+        av_free(data);
+        return nullptr;
+    }
+
+    (*counters)->allocations++;
+    int64_t pool_size = ++(*counters)->pool_size;
+    int64_t peak_pool_size = (*counters)->peak_pool_size.load();
+    while (pool_size > peak_pool_size
+        && !(*counters)->peak_pool_size.compare_exchange_weak(peak_pool_size, pool_size)) {
+    }
+    return buf;
+}
+
+void FFSWScale::freeBuffer(void *opaque, uint8_t *data) {
+    auto counters = static_cast<std::shared_ptr<PoolCounters>*>(opaque);
+    (*counters)->pool_size--;
+    delete counters;
+    av_free(data);
+}
+
+bool FFSWScale::initPool(int dst_align) {
+    int size = av_image_get_buffer_size(dst_pix_fmt_, dst_width_, dst_height_, dst_align);
+    if (size < 0)
+        return false;
+
+    // Same tail slack as av_image_alloc, SIMD writers may overrun the last line.
+    size += 16 + 64 - 1;
+    // Buffers of an old pool still count against its own counters.
+    counters_ = std::make_shared<PoolCounters>();
+    AVBufferPool *pool = av_buffer_pool_init2(size, this, allocBuffer, nullptr);
+    if (!pool)
+        return false;
+
+    // Buffers still held by consumers keep the old pool alive until released.
+    pool_ = AVBufferPoolPtr(pool, [](AVBufferPool *p) {
+        av_buffer_pool_uninit(&p);
+    });
+    pool_align_ = dst_align;
+    buffer_size_.store(size);
     return true;
 }
 
+std::shared_ptr<AVFrame> FFSWScale::allocFrame(int dst_align) {
+    if (!pool_ || pool_align_ != dst_align) {
+        if (!initPool(dst_align))
+            return nullptr;
+    }
+
+    AVFrame *frame = av_frame_alloc();
+    if (!frame)
+        return nullptr;
+
+    frame->buf[0] = av_buffer_pool_get(pool_.get());
+    if (!frame->buf[0]) {
+        av_frame_free(&frame);
+        return nullptr;
+    }
+
+    int ret = av_image_fill_arrays(
+        frame->data, frame->linesize, frame->buf[0]->data,
+        dst_pix_fmt_, dst_width_, dst_height_, dst_align);
+    if (ret < 0) {
+        av_frame_free(&frame);
+        return nullptr;
+    }
+
+    counters_->requests++;
+    frame->width = dst_width_;
+    frame->height = dst_height_;
+    frame->format = dst_pix_fmt_;
+    return std::shared_ptr<AVFrame>(frame, [](AVFrame *p) {
+        av_frame_free(&p);
+    });
+}
+
 std::shared_ptr<AVFrame> FFSWScale::Scale(
     std::shared_ptr<AVFrame> src_frame,
     int src_index_y, int src_height, int dst_align
@@ -84,30 +288,79 @@ std::shared_ptr<AVFrame> FFSWScale::Scale(
     if (!context_) return nullptr;
 
     std::lock_guard<std::recursive_mutex> lock(mutex_);
-    AVFrame *dst_frame = av_frame_alloc();
+    int64_t start = FFAVStats::Start();
+    int64_t begin = FFAVTracer::Begin();
+    auto dst_frame = allocFrame(dst_align);
     if (!dst_frame)
         return nullptr;
 
-    int ret = av_image_alloc(
-        dst_frame->data, dst_frame->linesize,
-        dst_width_, dst_height_, dst_pix_fmt_, dst_align);
-    if (ret < 0) {
-        av_frame_free(&dst_frame);
+    int ret = av_frame_copy_props(dst_frame.get(), src_frame.get());
+    if (ret < 0)
         return nullptr;
-    }
+    setColorProps(dst_frame.get());
 
-    ret = sws_scale(context_.get(),
-        src_frame->data, src_frame->linesize, src_index_y, src_height,
-        dst_frame->data, dst_frame->linesize);
-    if (ret < 0) {
-        av_freep(&dst_frame->data[0]);
-        av_frame_free(&dst_frame);
+    if (!slice_contexts_.empty() && src_index_y == 0 && src_height == src_frame->height) {
+        ret = scaleSlices(src_frame.get(), dst_frame.get());
+    } else {
+        ret = sws_scale(context_.get(),
+            src_frame->data, src_frame->linesize, src_index_y, src_height,
+            dst_frame->data, dst_frame->linesize);
+    }
+    if (ret < 0)
         return nullptr;
+
+    stats_.Record(start, 1, av_image_get_buffer_size(dst_pix_fmt_, dst_width_, dst_height_, 1));
+    FFAVTracer::End("Scale", begin, -1, src_frame->pts);
+    return dst_frame;
+}
+
+void FFSWScale::setColorProps(AVFrame *frame) const {
+    auto src_desc = av_pix_fmt_desc_get(src_pix_fmt_);
+    auto dst_desc = av_pix_fmt_desc_get(dst_pix_fmt_);
+    if (!src_desc || !dst_desc)
+        return;
+
+    // sws converts range and matrix only, primaries and transfer pass through.
+    bool src_rgb = src_desc->flags & AV_PIX_FMT_FLAG_RGB;
+    if (dst_desc->flags & AV_PIX_FMT_FLAG_RGB) {
+        frame->colorspace = AVCOL_SPC_RGB;
+        frame->color_range = AVCOL_RANGE_JPEG;
+    } else {
+        // RGB input is encoded with the sws default ITU-R 601 matrix.
+        if (src_rgb)
+            frame->colorspace = AVCOL_SPC_BT470BG;
+
+        bool full = strncmp(dst_desc->name, "yuvj", 4) == 0;
+        int *inv_table, *table, src_range, dst_range, brightness, contrast, saturation;
+        if (sws_getColorspaceDetails(context_.get(), &inv_table, &src_range, &table, &dst_range,
+                &brightness, &contrast, &saturation) >= 0)
+            full = dst_range != 0;
+        frame->color_range = full ? AVCOL_RANGE_JPEG : AVCOL_RANGE_MPEG;
     }
 
-    std::shared_ptr<AVFrame> dst_frame_ptr(dst_frame, [](AVFrame *p) {
-        av_freep(&p->data[0]);
-        av_frame_free(&p);
-    });
-    return dst_frame_ptr;
+    // Chroma keeps its siting across equal subsampling, resampled chroma
+    // lands on the sws default left siting.
+    if (!dst_desc->log2_chroma_w && !dst_desc->log2_chroma_h)
+        frame->chroma_location = AVCHROMA_LOC_UNSPECIFIED;
+    else if (src_desc->log2_chroma_w != dst_desc->log2_chroma_w
+        || src_desc->log2_chroma_h != dst_desc->log2_chroma_h)
+        frame->chroma_location = AVCHROMA_LOC_LEFT;
+}
+
+FFSWScalePoolStats FFSWScale::GetPoolStats() const {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    if (!counters_)
+        return { 0, 0, 0, 0, buffer_size_.load() };
+
+    return {
+        counters_->requests.load(),
+        counters_->allocations.load(),
+        counters_->pool_size.load(),
+        counters_->peak_pool_size.load(),
+        buffer_size_.load(),
+    };
+}
+
+FFAVStatsSnapshot FFSWScale::GetStats() const {
+    return stats_.GetSnapshot();
 }
@@ -1,25 +1,49 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
 #include <functional>
 #include <iostream>
 #include <memory>
 #include <mutex>
+#include <thread>
+#include <vector>
+#include "avstats.h"
 #include "avutil.h"
 extern "C" {
 #define __STDC_CONSTANT_MACROS
+#include <libavutil/buffer.h>
 #include <libavutil/imgutils.h>
 #include <libswscale/swscale.h>
 }
 
+// pool_size: buffers alive in the current pool, idle or held by frames.
+struct FFSWScalePoolStats {
+    int64_t requests;
+    int64_t allocations;
+    int64_t pool_size;
+    int64_t peak_pool_size;
+    int64_t buffer_size;
+};
+
 class FFSWScale {
     using SwsContextPtr = std::unique_ptr<SwsContext, std::function<void(SwsContext*)>>;
     using SwsFilterPtr = std::unique_ptr<SwsFilter, std::function<void(SwsFilter*)>>;
+    using AVBufferPoolPtr = std::unique_ptr<AVBufferPool, std::function<void(AVBufferPool*)>>;
+    // Shared with the buffers, which may outlive the pool and the scaler.
+    struct PoolCounters {
+        std::atomic_int64_t requests{0};
+        std::atomic_int64_t allocations{0};
+        std::atomic_int64_t pool_size{0};
+        std::atomic_int64_t peak_pool_size{0};
+    };
 
 public:
     FFSWScale(
         int src_width, int src_height, AVPixelFormat src_pix_fmt,
         int dst_width, int dst_height, AVPixelFormat dst_pix_fmt,
         int flags);
+    ~FFSWScale();
     bool SetSrcFilter(
         float luma_gblur, float chroma_gblur, float luma_sharpen,
         float chroma_sharpen, float chroma_hshift, float chroma_vshift,
@@ -29,10 +53,24 @@ public:
         float chroma_sharpen, float chroma_hshift, float chroma_vshift,
         int verbose);
     bool SetParams(const std::vector<double>& params);
+    bool SetThreads(int threads);
     bool Init();
     std::shared_ptr<AVFrame> Scale(
         std::shared_ptr<AVFrame> src_frame,
         int src_index_y, int src_height, int dst_align);
+    FFSWScalePoolStats GetPoolStats() const;
+    FFAVStatsSnapshot GetStats() const;
+
+private:
+    static AVBufferRef* allocBuffer(void *opaque, size_t size);
+    static void freeBuffer(void *opaque, uint8_t *data);
+    bool initPool(int dst_align);
+    std::shared_ptr<AVFrame> allocFrame(int dst_align);
+    void setColorProps(AVFrame *frame) const;
+    bool initSlices();
+    void runSlices(int slice_index);
+    int scaleSlice(int slice_index, AVFrame *src_frame, AVFrame *dst_frame);
+    int scaleSlices(AVFrame *src_frame, AVFrame *dst_frame);
 
 private:
     mutable std::recursive_mutex mutex_;
@@ -47,4 +85,22 @@ private:
     int flags_;
     std::vector<double> params_;
     SwsContextPtr context_;
+    int threads_{1};
+    int slice_align_{1};
+    std::vector<SwsContextPtr> slice_contexts_;
+    std::vector<std::thread> slice_workers_;
+    std::mutex slice_mutex_;
+    std::condition_variable slice_start_;
+    std::condition_variable slice_done_;
+    uint64_t slice_generation_{0};
+    int slice_pending_{0};
+    int slice_result_{0};
+    bool slice_exit_{false};
+    AVFrame *slice_src_{nullptr};
+    AVFrame *slice_dst_{nullptr};
+    AVBufferPoolPtr pool_;
+    int pool_align_{0};
+    std::atomic_int64_t buffer_size_{0};
+    std::shared_ptr<PoolCounters> counters_;
+    FFAVStats stats_;
 };
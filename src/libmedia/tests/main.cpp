@@ -1,4 +1,5 @@
 #include <cassert>
+#include <chrono>
 #include "test_ffmpeg.h"
 #include "../avmedia.h"
 
@@ -24,6 +25,58 @@ void test_demux(const std::string& uri) {
     }
 }
 
+void test_readahead(const std::string& uri, int reps) {
+    auto run = [&](const std::string& name, std::function<std::shared_ptr<FFAVIO>()> createIO) {
+        double total = 0;
+        int64_t bytes = 0;
+        for (int i = 0; i < reps; i++) {
+            auto start = std::chrono::steady_clock::now();
+            auto demuxer = FFAVDemuxer::Create(uri, createIO());
+            assert(demuxer);
+
+            bytes = 0;
+            while (auto packet = demuxer->ReadPacket())
+                bytes += packet->size;
+            total += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        std::cout << name << ": " << total / reps * 1000 << " ms/pass, "
+            << bytes / (total / reps) / (1 << 20) << " MiB/s" << std::endl;
+    };
+
+    run("file", []() { return nullptr; });
+    run("mmap", [&]() { return FFAVMmapIO::Create(uri); });
+    run("uring", [&]() { return FFAVUringIO::Create(uri, { 16, 1 << 20, 32 << 20 }); });
+}
+
+void test_decode_threads(const std::string& uri, int frames) {
+    auto demuxer = FFAVDemuxer::Create(uri);
+    assert(demuxer);
+
+    for (auto i : demuxer->GetStreamIndexes()) {
+        auto codecpar = demuxer->GetStream(i)->GetStream()->codecpar;
+        if (codecpar->codec_type != AVMEDIA_TYPE_VIDEO)
+            continue;
+
+        auto decodestream = demuxer->GetDecodeStream(i, {.thread_count = 0});
+        assert(decodestream);
+        auto decoder = decodestream->GetDecoder();
+        assert(decoder->GetThreadCount() >= 1);
+        std::cout << "stream " << i << " " << codecpar->width << "x" << codecpar->height
+            << " auto threads: " << decoder->GetThreadCount()
+            << " type: " << decoder->GetThreadType() << std::endl;
+    }
+
+    int count = 0;
+    while (count < frames) {
+        auto [index, frame] = demuxer->ReadFrame();
+        if (!frame)
+            break;
+        count++;
+    }
+    assert(count > 0);
+    std::cout << uri << " frames decoded with auto threads: " << count << std::endl;
+}
+
 void test_remux(
     const std::string& src_uri,
     const std::string& dst_uri,
@@ -35,6 +88,7 @@ void test_remux(
     auto m = FFAVMedia::Create();
 
     auto demuxer = m->AddDemuxer(src_uri);
+    //demuxer->BuildIndex();
     demuxer->DumpStreams();
 
     auto muxer = m->AddMuxer(dst_uri, mux_fmt);
@@ -79,6 +133,7 @@ void test_remux(
     }
 
     m->SetOption({ { src_uri, -1 }, seek_timestamp, duration });
+    //m->SetPipeline(true, 64);
     if (!m->Remux()) {
         std::cout << "remux fail." << std::endl;
         return;
@@ -98,9 +153,11 @@ void test_transcode(
     auto m = FFAVMedia::Create();
 
     auto demuxer = m->AddDemuxer(src_uri);
+    //auto demuxer = m->AddDemuxer(src_uri, FFAVMmapIO::Create(src_uri));
     demuxer->DumpStreams();
 
     auto muxer = m->AddMuxer(dst_uri, mux_fmt);
+    //auto muxer = m->AddMuxer(dst_uri, mux_fmt, FFAVWriteIO::Create(dst_uri, { 4 << 20, 64 << 20, 0 }));
     muxer->SetDebug(debug);
 
     for (auto i : demuxer->GetStreamIndexes()) {
@@ -141,6 +198,7 @@ void test_transcode(
             assert(encoder->SetParameters(dst_codecpar));
             //encoder->SetGopSize(25);
             //encoder->SetMaxBFrames(2);
+            //encoder->SetProfile(FFAVEncodeProfile::Balanced);
             //encoder->SetOptions({
             //    { "force_key_frames", "expr:gte(t,n_forced*2)" },
             //    { "x264-params", "keyint=25:min-keyint=2:no-scenecut" },
@@ -177,6 +235,10 @@ void test_transcode(
     }
 
     m->SetOption({ { src_uri, -1 }, seek_timestamp, duration });
+    //m->SetPipeline(true, 8);
+    //m->SetAccurateSeek(true);
+    //m->SetChunks(4);
+    //m->SetTrace("/tmp/transcode.trace.json");
     if (!m->Transcode()) {
         std::cout << "Transcode fail." << std::endl;
         return;
@@ -190,9 +252,18 @@ int main() {
         //av_log_set_level(AV_LOG_DEBUG);
 
         test_demuxer("/opt/ffmpeg/sample/tiny/oceans.mp4");
+        //test_demuxer_buffer("/opt/ffmpeg/sample/tiny/oceans.mp4");
+        //test_demuxer_into("/opt/ffmpeg/sample/tiny/oceans.mp4");
+        //test_demuxer_batch("/opt/ffmpeg/sample/tiny/oceans.mp4", 32);
+        //test_demuxer_pump("/opt/ffmpeg/sample/tiny/oceans.mp4", 16);
+        //test_stats("/opt/ffmpeg/sample/tiny/oceans.mp4");
+        //test_jobs(200);
+        //test_media_ids(8, 1000);
 
         //test_demux("/opt/app/gweb/tests/play-from-disk/output.ivf");
         //test_demux("/opt/ffmpeg/sample/tiny/oceans.mp4");
+        //test_readahead("/opt/ffmpeg/sample/mp4/BigBuckBunny_320x180.mp4", 5);
+        //test_decode_threads("/opt/ffmpeg/sample/mp4/BigBuckBunny_320x180.mp4", 100);
         //test_remux(
         //    "/opt/ffmpeg/sample/tiny/1.mp4",
         //    "/opt/ffmpeg/sample/tiny/1-o.flv",
@@ -1,3 +1,7 @@
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <vector>
 #include "test_ffmpeg.h"
 #include "../avcodec.h"
 
@@ -20,3 +24,165 @@ void test_demuxer(const std::string& uri) {
     DeleteFormat(media_id, uri.c_str());
     DeleteMedia(media_id);
 }
+
+void test_demuxer_buffer(const std::string& uri) {
+    std::ifstream file(uri, std::ios::binary);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    assert(!data.empty());
+
+    uint32_t media_id = CreateMedia();
+    assert(AddDemuxerFromBuffer(media_id, uri.c_str(), data.data(), data.size()));
+
+    int count = 0;
+    while (auto packet = ReadPacket(media_id, uri.c_str())) {
+        count++;
+        FreePacket(const_cast<AVPacket*>(packet));
+    }
+    std::cout << uri << " packets from buffer: " << count << std::endl;
+
+    DeleteFormat(media_id, uri.c_str());
+    DeleteMedia(media_id);
+}
+
+void test_demuxer_into(const std::string& uri) {
+    uint32_t media_id = CreateMedia();
+    assert(AddDemuxer(media_id, uri.c_str()));
+
+    AVPacket *packet = av_packet_alloc();
+    int count = 0, ret = 0;
+    while ((ret = ReadPacketInto(media_id, uri.c_str(), packet)) == 0) {
+        count++;
+        av_packet_unref(packet);
+    }
+    assert(ret == AVERROR_EOF);
+    av_packet_free(&packet);
+    std::cout << uri << " packets moved: " << count << std::endl;
+
+    DeleteFormat(media_id, uri.c_str());
+    DeleteMedia(media_id);
+}
+
+void test_demuxer_batch(const std::string& uri, int batch) {
+    uint32_t media_id = CreateMedia();
+    assert(AddDemuxer(media_id, uri.c_str()));
+
+    std::vector<AVPacket*> packets(batch);
+    for (auto& packet : packets)
+        packet = av_packet_alloc();
+
+    int calls = 0, count = 0, ret = 0;
+    while ((ret = ReadPackets(media_id, uri.c_str(), packets.data(), batch)) > 0) {
+        calls++;
+        count += ret;
+        for (int i = 0; i < ret; i++)
+            av_packet_unref(packets[i]);
+    }
+    assert(ret == AVERROR_EOF);
+    for (auto& packet : packets)
+        av_packet_free(&packet);
+    std::cout << uri << " packets: " << count << " calls: " << calls << std::endl;
+
+    DeleteFormat(media_id, uri.c_str());
+    DeleteMedia(media_id);
+}
+
+void test_stats(const std::string& uri) {
+    SetStatsEnabled(true);
+    uint32_t media_id = CreateMedia();
+    assert(AddDemuxer(media_id, uri.c_str()));
+
+    AVPacket *packet = av_packet_alloc();
+    while (ReadPacketInto(media_id, uri.c_str(), packet) == 0)
+        av_packet_unref(packet);
+    av_packet_free(&packet);
+
+    const char *stats = AllocStatsStr(media_id);
+    assert(stats && strstr(stats, "\"stage\":\"demux\""));
+    std::cout << uri << " stats: " << stats << std::endl;
+    free((void*)stats);
+
+    DeleteFormat(media_id, uri.c_str());
+    DeleteMedia(media_id);
+    SetStatsEnabled(false);
+}
+
+static MediaSinkStatus countPackets(void* opaque, int32_t, AVPacket**, int count) {
+    auto counts = static_cast<int*>(opaque);
+    counts[0] += count;
+    counts[1]++;
+    // Push back once to check the batch is handed again.
+    if (counts[1] == 2) {
+        counts[0] -= count;
+        return MEDIA_SINK_BUSY;
+    }
+    return MEDIA_SINK_ACCEPTED;
+}
+
+void test_demuxer_pump(const std::string& uri, int batch) {
+    uint32_t media_id = CreateMedia();
+    assert(AddDemuxer(media_id, uri.c_str()));
+
+    auto context = GetFormatContext(media_id, uri.c_str());
+    int counts[2] = { 0, 0 };
+    for (unsigned i = 0; i < context->nb_streams; i++)
+        assert(SetPacketCallback(media_id, uri.c_str(), i, counts, countPackets, batch));
+
+    MediaPumpStatus status;
+    int busy = 0;
+    while ((status = PumpMedia(media_id, uri.c_str(), 0)) == MEDIA_PUMP_BUSY)
+        busy++;
+    assert(status == MEDIA_PUMP_END);
+    assert(busy == 1);
+    std::cout << uri << " packets pushed: " << counts[0] << " batches: " << counts[1] << std::endl;
+
+    DeleteFormat(media_id, uri.c_str());
+    DeleteMedia(media_id);
+}
+
+void test_jobs(int count) {
+    assert(SetMaxRunningJobs(1));
+
+    // Medias without rules fail at once, the later pending ones get cancelled.
+    std::vector<uint32_t> medias, jobs;
+    for (int i = 0; i < count; i++) {
+        medias.push_back(CreateMedia());
+        jobs.push_back(SubmitJob(medias.back(), MEDIA_JOB_REMUX, i % 3));
+        assert(jobs.back() != 0);
+    }
+
+    int cancelled = 0;
+    for (int i = count - 1; i >= count / 2; i--)
+        cancelled += CancelJob(jobs[i]);
+
+    for (int i = 0; i < count; i++) {
+        auto state = WaitJob(jobs[i]);
+        assert(state == MEDIA_JOB_FAILED || state == MEDIA_JOB_CANCELLED);
+        assert(ReleaseJob(jobs[i]));
+        assert(PollJob(jobs[i]) == MEDIA_JOB_UNKNOWN);
+        DeleteMedia(medias[i]);
+    }
+    std::cout << "jobs: " << count << " cancelled: " << cancelled << std::endl;
+    assert(SetMaxRunningJobs(0));
+}
+
+void test_media_ids(int threads, int rounds) {
+    uint32_t stale = CreateMedia();
+    assert(stale != 0);
+    assert(DeleteMedia(stale));
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([rounds, stale]() {
+            for (int i = 0; i < rounds; i++) {
+                uint32_t media_id = CreateMedia();
+                assert(media_id != 0 && media_id != stale);
+                assert(!AddDemuxer(stale, "none"));
+                assert(DeleteMedia(media_id));
+                assert(!DeleteMedia(media_id));
+            }
+        });
+    }
+    for (auto& worker : workers)
+        worker.join();
+    std::cout << "media ids: " << threads * rounds << " created and deleted" << std::endl;
+}
@@ -5,3 +5,10 @@
 #include "../ffmpeg.h"
 
 void test_demuxer(const std::string& uri);
+void test_demuxer_buffer(const std::string& uri);
+void test_demuxer_into(const std::string& uri);
+void test_demuxer_batch(const std::string& uri, int batch);
+void test_demuxer_pump(const std::string& uri, int batch);
+void test_stats(const std::string& uri);
+void test_jobs(int count);
+void test_media_ids(int threads, int rounds);